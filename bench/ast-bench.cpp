@@ -0,0 +1,228 @@
+#include<bits/stdc++.h>
+#include <benchmark/benchmark.h>
+#include "../my-lang-codegen.hpp"
+
+//===----------------------------------------------------------------------===//
+// Arena/tagged AST versus the original unique_ptr/virtual AST: heap
+// allocations and time to parse, and to parse plus emit IR, the same input.
+//===----------------------------------------------------------------------===//
+
+static std::atomic<size_t> NumAllocs{0};
+
+void *operator new(size_t Size) {
+    NumAllocs.fetch_add(1, std::memory_order_relaxed);
+    if (void *P = malloc(Size ? Size : 1))
+        return P;
+    abort();
+}
+void operator delete(void *P) noexcept { free(P); }
+void operator delete(void *P, size_t) noexcept { free(P); }
+
+
+/// legacy - The AST as it was before arena allocation: one heap node per
+/// expression, owned through unique_ptr, codegen through a vtable, names as
+/// strings looked up in std::map and the module symbol table.
+namespace legacy {
+
+static std::map<std::string, llvm::Value *> NamedValues;
+
+class ExprAST {
+    public:
+        virtual ~ExprAST() {}
+        virtual llvm::Value *codegen() = 0;
+};
+
+class NumberExprAST : public ExprAST {
+    double Val;
+
+    public:
+        NumberExprAST(double Val) : Val(Val) {}
+        llvm::Value *codegen() override {
+            return llvm::ConstantFP::get(*TheContext, llvm::APFloat(Val));
+        }
+};
+
+class VariableExprAST : public ExprAST {
+    std::string Name;
+
+    public:
+        VariableExprAST(const std::string &Name) : Name(Name) {}
+        llvm::Value *codegen() override { return NamedValues[Name]; }
+};
+
+class BinaryExprAST : public ExprAST {
+    char Op;
+    std::unique_ptr<ExprAST> LHS, RHS;
+
+    public:
+        BinaryExprAST(char op, std::unique_ptr<ExprAST> LHS, std::unique_ptr<ExprAST> RHS):
+            Op(op), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
+
+        llvm::Value *codegen() override {
+            llvm::Value *L = LHS->codegen();
+            llvm::Value *R = RHS->codegen();
+            switch(Op) {
+                case '+': return Builder->CreateFAdd(L,R,"addtmp");
+                case '-': return Builder->CreateFSub(L,R,"subtmp");
+                case '*': return Builder->CreateFMul(L,R,"multmp");
+                default:  return Builder->CreateFCmpULT(L,R,"cmptmp");
+            }
+        }
+};
+
+class CallExprAST : public ExprAST {
+    std::string Callee;
+    std::vector<std::unique_ptr<ExprAST>> Args;
+
+    public:
+        CallExprAST(const std::string &Callee, std::vector<std::unique_ptr<ExprAST>> Args):
+            Callee(Callee), Args(std::move(Args)) {}
+
+        llvm::Value *codegen() override {
+            std::vector<llvm::Value *> ArgsV;
+            for (auto &A : Args)
+                ArgsV.push_back(A->codegen());
+            return Builder->CreateCall(TheModule->getFunction(Callee), ArgsV, "calltmp");
+        }
+};
+
+static std::unique_ptr<ExprAST> ParseExpression(Parser &P);
+
+static std::unique_ptr<ExprAST> ParsePrimary(Parser &P) {
+    if (P.getCurTok() == tok_number) {
+        auto Result = std::make_unique<NumberExprAST>(P.getLexer().getNumVal());
+        P.getNextToken();
+        return std::move(Result);
+    }
+    if (P.getCurTok() == '(') {
+        P.getNextToken();
+        auto V = ParseExpression(P);
+        P.getNextToken();
+        return V;
+    }
+    std::string IdName = P.getLexer().getIdentifierStr().str();
+    P.getNextToken();
+    if (P.getCurTok() != '(')
+        return std::make_unique<VariableExprAST>(IdName);
+    P.getNextToken();
+    std::vector<std::unique_ptr<ExprAST>> Args;
+    while (P.getCurTok() != ')') {
+        Args.push_back(ParseExpression(P));
+        if (P.getCurTok() == ',')
+            P.getNextToken();
+    }
+    P.getNextToken();
+    return std::make_unique<CallExprAST>(IdName, std::move(Args));
+}
+
+static std::unique_ptr<ExprAST> ParseBinOpRHS(Parser &P, int ExprPrec,
+                                              std::unique_ptr<ExprAST> LHS) {
+    while (1) {
+        int TokPrec = P.GetTokPrecedence();
+        if (TokPrec < ExprPrec)
+            return LHS;
+        int BinOp = P.getCurTok();
+        P.getNextToken();
+        auto RHS = ParsePrimary(P);
+        if (TokPrec < P.GetTokPrecedence())
+            RHS = ParseBinOpRHS(P, TokPrec + 1, std::move(RHS));
+        LHS = std::make_unique<BinaryExprAST>(BinOp, std::move(LHS), std::move(RHS));
+    }
+}
+
+static std::unique_ptr<ExprAST> ParseExpression(Parser &P) {
+    return ParseBinOpRHS(P, 0, ParsePrimary(P));
+}
+
+} // end namespace legacy
+
+
+/// makeSource - Many small definitions whose bodies mix arithmetic, nesting
+/// and calls to earlier definitions.
+static const std::string &makeSource() {
+    static std::string Src;
+    if (!Src.empty())
+        return Src;
+
+    std::mt19937 Rng(7);
+    char Buf[128];
+    for (unsigned I = 0; I < 2000; I++) {
+        snprintf(Buf, sizeof(Buf), "def f%u(x y) ", I);
+        Src += Buf;
+        for (unsigned T = 0; T < 12; T++) {
+            if (T)
+                Src += "+-*"[Rng() % 3];
+            switch (Rng() % 4) {
+                case 0: snprintf(Buf, sizeof(Buf), "%u.5", (unsigned)(Rng() % 100)); break;
+                case 1: snprintf(Buf, sizeof(Buf), "(x*y - %u)", (unsigned)(Rng() % 10)); break;
+                case 2: snprintf(Buf, sizeof(Buf), "%s", Rng() % 2 ? "x" : "y"); break;
+                default:
+                    if (I)
+                        snprintf(Buf, sizeof(Buf), "f%u(x, y+1)", (unsigned)(Rng() % I));
+                    else
+                        snprintf(Buf, sizeof(Buf), "x");
+            }
+            Src += Buf;
+        }
+        Src += ";\n";
+    }
+    return Src;
+}
+
+/// emitFunction - Shared scaffolding around body codegen so that both ASTs
+/// are measured doing exactly the same IR construction.
+template <bool Arena, typename BodyFn>
+static void emitFunction(PrototypeAST &Proto, BodyFn EmitBody) {
+    llvm::Function *F = Proto.codegen();
+    Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", F));
+    NamedValues.clear();
+    legacy::NamedValues.clear();
+    unsigned Idx = 0;
+    for (auto &Arg : F->args()) {
+        if (Arena)
+            NamedValues[Proto.getArgs()[Idx++]] = &Arg;
+        else
+            legacy::NamedValues[std::string(Arg.getName())] = &Arg;
+    }
+    Builder->CreateRet(EmitBody());
+}
+
+template <bool Arena, bool Codegen>
+static void BM_AST(benchmark::State &State) {
+    size_t Allocs = 0;
+    for (auto _ : State) {
+        if (Codegen)
+            InitializeModule();
+        Parser P;
+        // Both variants build the tree exactly as written.
+        P.setSimplify(false);
+        P.getLexer().setBuffer(makeSource());
+        P.getNextToken();
+
+        size_t Before = NumAllocs.load(std::memory_order_relaxed);
+        while (P.getCurTok() == tok_def) {
+            P.getNextToken(); // eat def.
+            auto Proto = P.ParsePrototype();
+            if (Arena) {
+                ASTArena A;
+                ExprAST *Body = P.ParseExpression(A);
+                if (Codegen)
+                    emitFunction<true>(*Proto, [&] { return Body->codegen(); });
+            } else {
+                auto Body = legacy::ParseExpression(P);
+                if (Codegen)
+                    emitFunction<false>(*Proto, [&] { return Body->codegen(); });
+            }
+            P.getNextToken(); // eat ';'.
+        }
+        Allocs += NumAllocs.load(std::memory_order_relaxed) - Before;
+    }
+    State.counters["allocs"] = benchmark::Counter(Allocs, benchmark::Counter::kAvgIterations);
+    State.SetBytesProcessed(State.iterations() * makeSource().size());
+}
+BENCHMARK_TEMPLATE(BM_AST, false, false)->Name("Parse/unique_ptr")->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_AST, true, false)->Name("Parse/arena")->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_AST, false, true)->Name("ParseCodegen/unique_ptr")->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(BM_AST, true, true)->Name("ParseCodegen/arena")->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,144 @@
+#include<bits/stdc++.h>
+#include <benchmark/benchmark.h>
+#include "../my-lang-batch.hpp"
+
+//===----------------------------------------------------------------------===//
+// Evaluating a definition over many rows: a call per row to the scalar
+// function versus one call to its batch entry point.
+//
+// wave calls libm. With --veclib=libmvec (or svml) its batch loop can call
+// the library's SIMD variants of sin/cos/exp instead of staying scalar.
+//===----------------------------------------------------------------------===//
+
+static const char *Source = R"(
+def sq(x) x*x;
+def lerp(a b t) a + (b-a)*t;
+def score(a b c d) 0.25*sq(a-b) + 1.5*a*c - d*(0.5*b + 2) + lerp(a, d, 0.3);
+def horner(x) ((((0.5*x - 1.25)*x + 2)*x - 0.75)*x + 3)*x - 0.5;
+extern sin(x);
+extern cos(x);
+extern exp(x);
+def wave(x) sin(3*x)*exp(0 - x*x) + 0.5*cos(x);
+)";
+
+/// setUp - JIT the definitions in Source, once.
+static void setUp() {
+    if (TheJIT)
+        return;
+    KaleidoscopeJIT::Options Opts;
+    Opts.OptimizeModule = optimizeModule;
+    TheJIT = ExitOnErr(KaleidoscopeJIT::Create(Opts));
+
+    Parser P;
+    P.getLexer().setBuffer(Source);
+    P.getNextToken();
+    while (P.getCurTok() == tok_def || P.getCurTok() == tok_extern) {
+        if (P.getCurTok() == tok_extern) {
+            auto ProtoAST = P.ParseExtern();
+            Externs.insert(ProtoAST->getSymbol());
+            FunctionProtos[ProtoAST->getSymbol()] = std::move(ProtoAST);
+        } else {
+            auto FnAST = P.ParseDefinition();
+            InitializeModule();
+            FnAST->codegen();
+            ExitOnErr(TheJIT->addModule(
+                llvm::orc::ThreadSafeModule(std::move(TheModule), std::move(TheContext))));
+            FunctionDefs[FnAST->getProto().getSymbol()] = std::move(FnAST);
+        }
+        if (P.getCurTok() == ';')
+            P.getNextToken();
+    }
+    InitializeModule();
+}
+
+struct Columns {
+    std::vector<std::vector<double>> Data;
+    std::vector<const double *> Ptrs;
+    std::vector<double> Out;
+
+    Columns(unsigned Arity, size_t Rows) : Data(Arity), Out(Rows) {
+        std::mt19937 Rng(5);
+        std::uniform_real_distribution<double> Dist(-2, 2);
+        for (auto &Col : Data) {
+            Col.resize(Rows);
+            for (double &X : Col)
+                X = Dist(Rng);
+            Ptrs.push_back(Col.data());
+        }
+    }
+};
+
+/// runScalar - Fill C.Out with a call per row to the scalar function at Addr.
+static void runScalar(uint64_t Addr, unsigned Arity, Columns &C) {
+    size_t Rows = C.Out.size();
+    if (Arity == 1) {
+        auto *F = (double (*)(double))Addr;
+        for (size_t I = 0; I < Rows; ++I)
+            C.Out[I] = F(C.Ptrs[0][I]);
+    } else {
+        auto *F = (double (*)(double, double, double, double))Addr;
+        for (size_t I = 0; I < Rows; ++I)
+            C.Out[I] = F(C.Ptrs[0][I], C.Ptrs[1][I], C.Ptrs[2][I], C.Ptrs[3][I]);
+    }
+}
+
+static void BM_Scalar(benchmark::State &State, const char *Name, unsigned Arity) {
+    setUp();
+    uint64_t Addr = ExitOnErr(TheJIT->lookup(Name)).getAddress();
+    Columns C(Arity, State.range(0));
+    for (auto _ : State) {
+        runScalar(Addr, Arity, C);
+        benchmark::ClobberMemory();
+    }
+    State.SetItemsProcessed(State.iterations() * C.Out.size());
+}
+
+static void BM_Batch(benchmark::State &State, const char *Name, unsigned Arity) {
+    setUp();
+    BatchFunction F = ExitOnErr(getBatchFunction(Name));
+    Columns C(Arity, State.range(0));
+
+    // A vector loop that computes something else is no speedup. Vector math
+    // libraries may round differently from libm, so allow for a few ulps.
+    std::vector<double> Expected(C.Out.size());
+    runScalar(ExitOnErr(TheJIT->lookup(Name)).getAddress(), Arity, C);
+    Expected.swap(C.Out);
+    F(C.Ptrs, C.Out.data(), C.Out.size());
+    for (size_t I = 0; I < C.Out.size(); ++I)
+        if (!(std::fabs(C.Out[I] - Expected[I]) <= 1e-12 * std::max(1.0, std::fabs(Expected[I])))) {
+            State.SkipWithError("batch entry point disagrees with the scalar function");
+            return;
+        }
+
+    for (auto _ : State) {
+        F(C.Ptrs, C.Out.data(), C.Out.size());
+        benchmark::ClobberMemory();
+    }
+    State.SetItemsProcessed(State.iterations() * C.Out.size());
+}
+
+BENCHMARK_CAPTURE(BM_Scalar, score, "score", 4)->Arg(1 << 14)->Arg(1 << 20);
+BENCHMARK_CAPTURE(BM_Batch, score, "score", 4)->Arg(1 << 14)->Arg(1 << 20);
+BENCHMARK_CAPTURE(BM_Scalar, horner, "horner", 1)->Arg(1 << 14)->Arg(1 << 20);
+BENCHMARK_CAPTURE(BM_Batch, horner, "horner", 1)->Arg(1 << 14)->Arg(1 << 20);
+BENCHMARK_CAPTURE(BM_Scalar, wave, "wave", 1)->Arg(1 << 14)->Arg(1 << 20);
+BENCHMARK_CAPTURE(BM_Batch, wave, "wave", 1)->Arg(1 << 14)->Arg(1 << 20);
+
+int main(int argc, char **argv) {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+    benchmark::Initialize(&argc, argv);
+    // Flags of our own, left over after the benchmark library's.
+    for (int i = 1; i < argc; ++i) {
+        llvm::StringRef Arg = argv[i];
+        if (Arg.consume_front("--veclib="))
+            ExitOnErr(setVecLib(Arg));
+        else {
+            fprintf(stderr, "batch-bench: unknown option '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include<bits/stdc++.h>
+#include "../my-lang-codegen.hpp"
+
+//===----------------------------------------------------------------------===//
+// Which numerical guarantees each floating-point mode gives up: the same
+// kernels compiled strictly, as a.out does by default, and with --fast-math,
+// --reassoc and --fp-contract=fast, each checked against the result it must
+// give in that mode. Exits with 1 if a mode keeps a guarantee it should give
+// up, or gives up one it should keep.
+//===----------------------------------------------------------------------===//
+
+static const char *Source = R"(
+extern sqrt(x);
+def cancel(x) (x+10000000000000000)-10000000000000000;
+def nanless(x) sqrt(x) < 1;
+def muladd(a b c) a*b + c;
+def drift(x) var s = 18014398509481984 in (for i = 0, i < 1000 in s = s + x) : s - 18014398509481984;
+)";
+
+/// HasFMA - Whether the host, which the JIT compiles for, has FMA
+/// instructions. Without them nothing is contracted.
+static bool HasFMA = false;
+
+struct Kernel {
+    const char *Name;
+    unsigned Arity;
+    double Args[3];
+    /// Strict - The IEEE result.
+    double Strict;
+    /// Relaxed - The result once RelaxedBy allows it to change, or NaN if
+    /// it is only known to differ from Strict.
+    double Relaxed;
+    bool (*RelaxedBy)(const llvm::FastMathFlags &);
+};
+
+static const double Eps30 = std::ldexp(1.0, -30);
+
+static const Kernel Kernels[] = {
+    // x+1e16 rounds x = 1 away. Reassociated, the constants cancel and x is
+    // kept; that also needs nsz, as for x = -0 the strict result is +0.
+    {"cancel", 1, {1}, 0, 1,
+     [](const llvm::FastMathFlags &F) { return F.allowReassoc() && F.noSignedZeros(); }},
+    // sqrt(-1) is NaN, and NaN < 1 is true, like every unordered comparison.
+    // With nnan, what a NaN compares as is unspecified.
+    {"nanless", 1, {-1}, 1, NAN,
+     [](const llvm::FastMathFlags &F) { return F.noNaNs(); }},
+    // (1+2^-30)^2 = 1 + 2^-29 + 2^-60: the product rounds 2^-60 away, the FMA
+    // keeps it.
+    {"muladd", 3, {1 + Eps30, 1 + Eps30, -(1 + 2 * Eps30)}, 0, std::ldexp(1.0, -60),
+     [](const llvm::FastMathFlags &F) { return F.allowContract() && HasFMA; }},
+    // Added to 2^54 one at a time, each 1 rounds away. A vectorized sum adds
+    // them up in lanes of their own before adding 2^54.
+    {"drift", 1, {1}, 0, NAN,
+     [](const llvm::FastMathFlags &F) { return F.allowReassoc(); }},
+};
+
+struct Mode {
+    const char *Name;
+    void (*Set)(llvm::FastMathFlags &);
+};
+
+static const Mode Modes[] = {
+    {"default", [](llvm::FastMathFlags &) {}},
+    {"--fast-math", [](llvm::FastMathFlags &F) { F.setFast(); }},
+    {"--reassoc", [](llvm::FastMathFlags &F) { F.setAllowReassoc(); }},
+    {"--fp-contract=fast", [](llvm::FastMathFlags &F) { F.setAllowContract(true); }},
+};
+
+/// compile - JIT Source with the current FPFlags, in a JIT of its own, as
+/// its target options depend on them.
+static void compile() {
+    KaleidoscopeJIT::Options Opts;
+    Opts.OptimizeModule = optimizeModule;
+    Opts.CodeGenOptLevel = getCodeGenOptLevel();
+    Opts.TargetOptions = getTargetOptions();
+    TheJIT = ExitOnErr(KaleidoscopeJIT::Create(Opts));
+
+    Parser P;
+    P.getLexer().setBuffer(Source);
+    P.getNextToken();
+    while (P.getCurTok() == tok_def || P.getCurTok() == tok_extern) {
+        if (P.getCurTok() == tok_extern) {
+            auto ProtoAST = P.ParseExtern();
+            Externs.insert(ProtoAST->getSymbol());
+            FunctionProtos[ProtoAST->getSymbol()] = std::move(ProtoAST);
+        } else {
+            auto FnAST = P.ParseDefinition();
+            InitializeModule();
+            FnAST->codegen();
+            ExitOnErr(TheJIT->addModule(
+                llvm::orc::ThreadSafeModule(std::move(TheModule), std::move(TheContext))));
+        }
+        if (P.getCurTok() == ';')
+            P.getNextToken();
+    }
+}
+
+static double call(const Kernel &K) {
+    uint64_t Addr = ExitOnErr(TheJIT->lookup(K.Name)).getAddress();
+    if (K.Arity == 1)
+        return ((double (*)(double))Addr)(K.Args[0]);
+    return ((double (*)(double, double, double))Addr)(K.Args[0], K.Args[1], K.Args[2]);
+}
+
+int main() {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    llvm::StringMap<bool> Features;
+    HasFMA = llvm::sys::getHostCPUFeatures(Features) && Features.lookup("fma");
+    if (!HasFMA)
+        printf("no FMA on this host: --fp-contract=fast is expected to change nothing\n");
+
+    unsigned Failures = 0;
+    for (auto &M : Modes) {
+        FPFlags.clear();
+        M.Set(FPFlags);
+        compile();
+        for (auto &K : Kernels) {
+            double Result = call(K);
+            const char *Expected;
+            bool OK;
+            if (!K.RelaxedBy(FPFlags)) {
+                Expected = "strict";
+                OK = Result == K.Strict;
+            } else if (std::isnan(K.Relaxed)) {
+                Expected = "not strict";
+                OK = Result != K.Strict;
+            } else {
+                Expected = "relaxed";
+                OK = Result == K.Relaxed;
+            }
+            printf("%-20s %-8s = %-12g (strict %g) expected %s%s\n", M.Name, K.Name, Result,
+                   K.Strict, Expected, OK ? "" : ": FAILED");
+            Failures += !OK;
+        }
+        Builder.reset();
+        TheModule.reset();
+        TheJIT.reset();
+    }
+    return Failures ? 1 : 0;
+}
@@ -0,0 +1,44 @@
+#include<bits/stdc++.h>
+#include "kal-socket.hpp"
+
+//===----------------------------------------------------------------------===//
+// Run source in one session of an evaluation server, a line per request:
+//   ./a.out --serve=/tmp/kal.sock lib.ks &
+//   echo 'def g(x) f1(x) * 2; g(3);' | ./kal-client /tmp/kal.sock
+//===----------------------------------------------------------------------===//
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s SOCKET [FILE]\n", argv[0]);
+        return 1;
+    }
+    FILE *In = argc > 2 ? fopen(argv[2], "r") : stdin;
+    if (!In) {
+        perror(argv[2]);
+        return 1;
+    }
+    KalConnection Conn;
+    if (!Conn.open(argv[1])) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    char *Line = nullptr;
+    size_t Capacity = 0;
+    ssize_t Length;
+    std::string Response;
+    while ((Length = getline(&Line, &Capacity, In)) >= 0) {
+        std::string Request(Line, Length);
+        while (!Request.empty() && (Request.back() == '\n' || Request.back() == '\r'))
+            Request.pop_back();
+        if (Request.find_first_not_of(" \t") == std::string::npos)
+            continue;
+        if (!Conn.request(Request, Response)) {
+            fprintf(stderr, "%s: server closed the connection\n", argv[0]);
+            return 1;
+        }
+        puts(Response.c_str());
+    }
+    free(Line);
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include<bits/stdc++.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//===----------------------------------------------------------------------===//
+// Talking to a ./a.out --serve=SOCKET server: one connection is one session,
+// each request line gets one response line.
+//===----------------------------------------------------------------------===//
+
+class KalConnection {
+    int FD = -1;
+    std::string Buffer;
+
+    public:
+        KalConnection() = default;
+        KalConnection(const KalConnection &) = delete;
+        KalConnection &operator=(const KalConnection &) = delete;
+        ~KalConnection() {
+            if (FD >= 0)
+                close(FD);
+        }
+
+        /// open - Connect to the server listening on Path; false, with errno
+        /// set, if there is none.
+        bool open(const std::string &Path) {
+            sockaddr_un Addr = {};
+            Addr.sun_family = AF_UNIX;
+            if (Path.size() >= sizeof(Addr.sun_path)) {
+                errno = ENAMETOOLONG;
+                return false;
+            }
+            memcpy(Addr.sun_path, Path.data(), Path.size());
+            FD = socket(AF_UNIX, SOCK_STREAM, 0);
+            return FD >= 0 && connect(FD, (sockaddr *)&Addr, sizeof(Addr)) == 0;
+        }
+
+        /// request - Send Line (without its newline) and wait for the
+        /// response; false if the server went away.
+        bool request(const std::string &Line, std::string &Response) {
+            std::string Out = Line + "\n";
+            for (size_t Done = 0; Done < Out.size();) {
+                ssize_t N = write(FD, Out.data() + Done, Out.size() - Done);
+                if (N < 0 && errno == EINTR)
+                    continue;
+                if (N <= 0)
+                    return false;
+                Done += N;
+            }
+            size_t End;
+            while ((End = Buffer.find('\n')) == std::string::npos) {
+                char Chunk[4096];
+                ssize_t N = read(FD, Chunk, sizeof(Chunk));
+                if (N < 0 && errno == EINTR)
+                    continue;
+                if (N <= 0)
+                    return false;
+                Buffer.append(Chunk, N);
+            }
+            Response = Buffer.substr(0, End);
+            Buffer.erase(0, End + 1);
+            return true;
+        }
+};
@@ -0,0 +1,98 @@
+#include<bits/stdc++.h>
+#include <fcntl.h>
+#include <benchmark/benchmark.h>
+#include "../my-lang-lexer.hpp"
+
+//===----------------------------------------------------------------------===//
+// Lexer throughput: MB/s of source turned into tokens, for each input mode.
+//===----------------------------------------------------------------------===//
+
+/// makeSource - A few MB of generated Kaleidoscope: definitions, calls,
+/// long-ish identifiers, numeric literals and comments.
+static const std::string &makeSource() {
+    static std::string Src;
+    if (!Src.empty())
+        return Src;
+
+    std::mt19937 Rng(42);
+    char Line[256];
+    for (unsigned I = 0; Src.size() < 8 * 1024 * 1024; I++) {
+        snprintf(Line, sizeof(Line), "# helper %u computes a weighted sum\n", I);
+        Src += Line;
+        snprintf(Line, sizeof(Line),
+                 "def helperFunction%u(alpha beta gamma) alpha*%u.%u + beta*gamma - %u.0;\n",
+                 I, (unsigned)(Rng() % 1000), (unsigned)(Rng() % 100000),
+                 (unsigned)(Rng() % 100));
+        Src += Line;
+        snprintf(Line, sizeof(Line), "helperFunction%u(1.5, %u.25, (2+3)*4);\n",
+                 I, (unsigned)(Rng() % 1000));
+        Src += Line;
+    }
+    return Src;
+}
+
+/// sourceFile - makeSource() written to a temporary file, for the file and
+/// stream modes.
+static const std::string &sourceFile() {
+    static std::string Path;
+    if (Path.empty()) {
+        char Tmpl[] = "/tmp/lexer-bench-XXXXXX";
+        int FD = mkstemp(Tmpl);
+        const std::string &Src = makeSource();
+        if (FD < 0 || write(FD, Src.data(), Src.size()) != (ssize_t)Src.size())
+            abort();
+        close(FD);
+        Path = Tmpl;
+    }
+    return Path;
+}
+
+static size_t lexAll(Lexer &L) {
+    size_t Tokens = 0;
+    while (L.gettok() != tok_eof)
+        Tokens++;
+    return Tokens;
+}
+
+static void BM_LexBuffer(benchmark::State &State) {
+    const std::string &Src = makeSource();
+    for (auto _ : State) {
+        Lexer L;
+        L.setBuffer(Src);
+        benchmark::DoNotOptimize(lexAll(L));
+    }
+    State.SetBytesProcessed(State.iterations() * Src.size());
+}
+BENCHMARK(BM_LexBuffer)->Unit(benchmark::kMillisecond);
+
+static void BM_LexMappedFile(benchmark::State &State) {
+    for (auto _ : State) {
+        Lexer L;
+        if (!L.setFile(sourceFile())) {
+            State.SkipWithError("cannot open input");
+            return;
+        }
+        benchmark::DoNotOptimize(lexAll(L));
+    }
+    State.SetBytesProcessed(State.iterations() * makeSource().size());
+}
+BENCHMARK(BM_LexMappedFile)->Unit(benchmark::kMillisecond);
+
+static void BM_LexStream(benchmark::State &State) {
+    for (auto _ : State) {
+        int FD = open(sourceFile().c_str(), O_RDONLY);
+        Lexer L;
+        L.setStream(FD);
+        benchmark::DoNotOptimize(lexAll(L));
+        close(FD);
+    }
+    State.SetBytesProcessed(State.iterations() * makeSource().size());
+}
+BENCHMARK(BM_LexStream)->Unit(benchmark::kMillisecond);
+
+int main(int argc, char **argv) {
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    unlink(sourceFile().c_str());
+    return 0;
+}
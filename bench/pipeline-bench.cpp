@@ -0,0 +1,299 @@
+#include<bits/stdc++.h>
+#include <benchmark/benchmark.h>
+#include "../my-lang-codegen.hpp"
+#include "workload.hpp"
+
+//===----------------------------------------------------------------------===//
+// Compiler pipeline throughput, phase by phase, on each synthetic workload,
+// and the speed of JIT'd numeric kernels at each optimization level.
+//
+//   Lex/W           tokens only
+//   Parse/W         lexing and parsing into ASTs
+//   ParseThreads/W/T
+//                   T threads, each parsing W with a Parser of its own, at
+//                   once; defs/s is the total over all threads
+//   IRGen/W         FunctionAST::codegen() of pre-parsed ASTs, one module
+//   Optimize/W/N    optimizeModule() at -ON, one module per definition as
+//                   the JIT does it
+//   Emit/W/N        machine code generation of modules optimized at -ON
+//   JIT/K/N         calls per second to kernel K compiled at -ON
+//
+// --scale=X multiplies the size of every workload; --no-simplify parses
+// without front-end simplification, to measure what it saves later phases;
+// --fast-math compiles everything as a.out --fast-math would.
+//===----------------------------------------------------------------------===//
+
+static bool Simplify = true;
+
+/// parseAll - Every definition in Src, in order.
+static std::vector<std::unique_ptr<FunctionAST>> parseAll(llvm::StringRef Src) {
+    std::vector<std::unique_ptr<FunctionAST>> Defs;
+    Parser P;
+    P.setSimplify(Simplify);
+    P.getLexer().setBuffer(Src);
+    P.getNextToken();
+    while (P.getCurTok() != tok_eof) {
+        if (P.getCurTok() != tok_def) {
+            P.getNextToken();
+            continue;
+        }
+        if (auto FnAST = P.ParseDefinition())
+            Defs.push_back(std::move(FnAST));
+        else
+            P.getNextToken();
+    }
+    return Defs;
+}
+
+/// generateModules - IR for each of Defs in a module and context of its own.
+static std::vector<llvm::orc::ThreadSafeModule>
+generateModules(const std::vector<std::unique_ptr<FunctionAST>> &Defs, size_t &Insts) {
+    std::vector<llvm::orc::ThreadSafeModule> Mods;
+    Insts = 0;
+    for (auto &FnAST : Defs) {
+        InitializeModule();
+        FnAST->codegen();
+        Insts += TheModule->getInstructionCount();
+        Mods.emplace_back(std::move(TheModule), std::move(TheContext));
+    }
+    return Mods;
+}
+
+static void BM_Lex(benchmark::State &State, const std::string *Src) {
+    size_t Tokens = 0;
+    for (auto _ : State) {
+        Lexer L;
+        L.setBuffer(*Src);
+        while (L.gettok() != tok_eof)
+            Tokens++;
+    }
+    State.SetBytesProcessed(State.iterations() * Src->size());
+    State.counters["tokens/s"] = benchmark::Counter(Tokens, benchmark::Counter::kIsRate);
+}
+
+static void BM_Parse(benchmark::State &State, const std::string *Src) {
+    size_t Defs = 0;
+    for (auto _ : State)
+        Defs += parseAll(*Src).size();
+    State.SetBytesProcessed(State.iterations() * Src->size());
+    State.counters["defs/s"] = benchmark::Counter(Defs, benchmark::Counter::kIsRate);
+}
+
+static void BM_ParseThreads(benchmark::State &State, const std::string *Src) {
+    unsigned Threads = State.range(0);
+    size_t Defs = 0;
+    for (auto _ : State) {
+        std::vector<size_t> Counts(Threads);
+        std::vector<std::thread> Workers;
+        for (unsigned T = 0; T < Threads; T++)
+            Workers.emplace_back([&, T] { Counts[T] = parseAll(*Src).size(); });
+        for (auto &W : Workers)
+            W.join();
+        for (size_t N : Counts)
+            Defs += N;
+    }
+    State.SetBytesProcessed(State.iterations() * Threads * Src->size());
+    State.counters["defs/s"] = benchmark::Counter(Defs, benchmark::Counter::kIsRate);
+}
+
+static void BM_IRGen(benchmark::State &State, const std::string *Src) {
+    auto Defs = parseAll(*Src);
+    size_t Insts = 0;
+    for (auto _ : State) {
+        InitializeModule();
+        for (auto &FnAST : Defs)
+            benchmark::DoNotOptimize(FnAST->codegen());
+        Insts += TheModule->getInstructionCount();
+    }
+    State.counters["defs/s"] = benchmark::Counter(State.iterations() * Defs.size(),
+                                                  benchmark::Counter::kIsRate);
+    State.counters["insts/s"] = benchmark::Counter(Insts, benchmark::Counter::kIsRate);
+}
+
+static void BM_Optimize(benchmark::State &State, const std::string *Src) {
+    OptLevel = State.range(0);
+    auto Defs = parseAll(*Src);
+    size_t Insts = 0;
+    for (auto _ : State) {
+        State.PauseTiming();
+        size_t N;
+        auto Mods = generateModules(Defs, N);
+        Insts += N;
+        State.ResumeTiming();
+
+        for (auto &TSM : Mods)
+            TSM.withModuleDo([](llvm::Module &M) {
+                optimizeModule(M, TheTargetMachine.get());
+            });
+
+        State.PauseTiming();
+        Mods.clear();
+        State.ResumeTiming();
+    }
+    State.counters["defs/s"] = benchmark::Counter(State.iterations() * Defs.size(),
+                                                  benchmark::Counter::kIsRate);
+    State.counters["insts/s"] = benchmark::Counter(Insts, benchmark::Counter::kIsRate);
+}
+
+static void BM_Emit(benchmark::State &State, const std::string *Src) {
+    OptLevel = State.range(0);
+    auto TM = ExitOnErr(createHostTargetMachine(getCodeGenOptLevel(), getTargetOptions()));
+    auto Defs = parseAll(*Src);
+    size_t Bytes = 0;
+    for (auto _ : State) {
+        State.PauseTiming();
+        size_t N;
+        auto Mods = generateModules(Defs, N);
+        for (auto &TSM : Mods)
+            TSM.withModuleDo([](llvm::Module &M) {
+                optimizeModule(M, TheTargetMachine.get());
+            });
+        State.ResumeTiming();
+
+        for (auto &TSM : Mods)
+            TSM.withModuleDo([&](llvm::Module &M) {
+                ObjectImage Obj;
+                ExitOnErr(emitObject(*TM, M, Obj));
+                Bytes += Obj.size();
+            });
+
+        State.PauseTiming();
+        Mods.clear();
+        State.ResumeTiming();
+    }
+    State.counters["defs/s"] = benchmark::Counter(State.iterations() * Defs.size(),
+                                                  benchmark::Counter::kIsRate);
+    State.SetBytesProcessed(Bytes);
+}
+
+
+//===----------------------------------------------------------------------===//
+// JIT'd kernels
+//===----------------------------------------------------------------------===//
+
+static const char *KernelSource = R"(
+def horner(x) ((((0.5*x - 1.25)*x + 2)*x - 0.75)*x + 3)*x - 0.5;
+def dist2(x1 y1 x2 y2) (x1-x2)*(x1-x2) + (y1-y2)*(y1-y2);
+def sq(x) x*x;
+def norm4(a b c d) sq(a) + sq(b) + sq(c) + sq(d);
+def lerp(a b t) a + (b-a)*t;
+def smooth(t) t*t*(3 - 2*t);
+def blend(a b t) lerp(a, b, smooth(t));
+def dot4(a b c d) a*a + b*b + c*c + d*d + a*b + c*d;
+)";
+
+struct Kernel {
+    const char *Name;
+    unsigned Arity;
+};
+
+static const Kernel Kernels[] = {
+    {"horner", 1}, {"dist2", 4}, {"norm4", 4}, {"blend", 3}, {"dot4", 4},
+};
+
+/// callKernel - Sum of the kernel at Addr over the argument tuples in In.
+template <unsigned Arity>
+static double callKernel(uint64_t Addr, const std::vector<double> &In) {
+    double Sum = 0;
+    const double *A = In.data();
+    for (size_t I = 0, E = In.size(); I + Arity <= E; I += Arity) {
+        switch (Arity) {
+            case 1: Sum += ((double (*)(double))Addr)(A[I]); break;
+            case 3: Sum += ((double (*)(double, double, double))Addr)(A[I], A[I+1], A[I+2]); break;
+            default:
+                Sum += ((double (*)(double, double, double, double))Addr)(A[I], A[I+1], A[I+2],
+                                                                         A[I+3]);
+        }
+    }
+    return Sum;
+}
+
+static void BM_JIT(benchmark::State &State, const Kernel *K) {
+    OptLevel = State.range(0);
+    KaleidoscopeJIT::Options Opts;
+    Opts.OptimizeModule = optimizeModule;
+    Opts.CodeGenOptLevel = getCodeGenOptLevel();
+    Opts.TargetOptions = getTargetOptions();
+    TheJIT = ExitOnErr(KaleidoscopeJIT::Create(Opts));
+
+    for (auto &FnAST : parseAll(KernelSource)) {
+        InitializeModule();
+        FnAST->codegen();
+        ExitOnErr(TheJIT->addModule(
+            llvm::orc::ThreadSafeModule(std::move(TheModule), std::move(TheContext))));
+    }
+    uint64_t Addr = ExitOnErr(TheJIT->lookup(K->Name)).getAddress();
+
+    std::mt19937 Rng(3);
+    std::uniform_real_distribution<double> Dist(-2, 2);
+    std::vector<double> In(4096 * K->Arity);
+    for (double &X : In)
+        X = Dist(Rng);
+
+    for (auto _ : State) {
+        switch (K->Arity) {
+            case 1: benchmark::DoNotOptimize(callKernel<1>(Addr, In)); break;
+            case 3: benchmark::DoNotOptimize(callKernel<3>(Addr, In)); break;
+            default: benchmark::DoNotOptimize(callKernel<4>(Addr, In));
+        }
+    }
+    State.SetItemsProcessed(State.iterations() * 4096);
+
+    Builder.reset();
+    TheModule.reset();
+    TheJIT.reset();
+}
+
+
+int main(int argc, char **argv) {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    double Scale = 1;
+    int Out = 1;
+    for (int I = 1; I < argc; I++) {
+        llvm::StringRef Arg = argv[I];
+        if (Arg.consume_front("--scale="))
+            Scale = strtod(Arg.str().c_str(), nullptr);
+        else if (Arg == "--no-simplify")
+            Simplify = false;
+        else if (Arg == "--fast-math")
+            FPFlags.setFast();
+        else
+            argv[Out++] = argv[I];
+    }
+    argc = Out;
+
+    // Modules for the pipeline benchmarks target the host, as the AOT
+    // compiler's would.
+    TheTargetMachine = ExitOnErr(createHostTargetMachine(llvm::CodeGenOpt::Default,
+                                                         getTargetOptions()));
+
+    static std::deque<std::string> Sources;
+    for (auto &W : Workloads) {
+        unsigned Size = std::max(1u, (unsigned)(W.DefaultSize * Scale));
+        Sources.push_back(generateWorkload(W.Kind, Size));
+        const std::string *Src = &Sources.back();
+        std::string Name = W.Name;
+        benchmark::RegisterBenchmark(("Lex/" + Name).c_str(), BM_Lex, Src)
+            ->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark(("Parse/" + Name).c_str(), BM_Parse, Src)
+            ->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark(("ParseThreads/" + Name).c_str(), BM_ParseThreads, Src)
+            ->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime()->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark(("IRGen/" + Name).c_str(), BM_IRGen, Src)
+            ->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark(("Optimize/" + Name).c_str(), BM_Optimize, Src)
+            ->Arg(1)->Arg(2)->Arg(3)->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark(("Emit/" + Name).c_str(), BM_Emit, Src)
+            ->Arg(0)->Arg(2)->Unit(benchmark::kMillisecond);
+    }
+    for (auto &K : Kernels)
+        benchmark::RegisterBenchmark((std::string("JIT/") + K.Name).c_str(), BM_JIT, &K)
+            ->DenseRange(0, 3)->Unit(benchmark::kMicrosecond);
+
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
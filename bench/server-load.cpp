@@ -0,0 +1,106 @@
+#include<bits/stdc++.h>
+#include "kal-socket.hpp"
+
+//===----------------------------------------------------------------------===//
+// Load an evaluation server with concurrent sessions and report the latency
+// of their requests:
+//   ./workload-gen many-small 200 > lib.ks
+//   ./a.out --serve=/tmp/kal.sock lib.ks &
+//   ./server-load /tmp/kal.sock --sessions=8 --requests=1000 --request='f12(1, 2);'
+//
+// Each session is a connection on a thread of its own. It sends the --setup
+// line once, untimed, then the --request line over and over, timing each
+// round trip.
+//===----------------------------------------------------------------------===//
+
+typedef std::chrono::steady_clock Clock;
+
+int main(int argc, char **argv) {
+    std::string Socket, Setup, Request = "1 + 2;";
+    unsigned Sessions = 4, Requests = 1000;
+    for (int i = 1; i < argc; ++i) {
+        std::string Arg = argv[i];
+        auto Value = [&](const char *Prefix) {
+            return Arg.compare(0, strlen(Prefix), Prefix) == 0 ? Arg.c_str() + strlen(Prefix)
+                                                                : nullptr;
+        };
+        if (const char *V = Value("--sessions="))
+            Sessions = atoi(V);
+        else if (const char *V = Value("--requests="))
+            Requests = atoi(V);
+        else if (const char *V = Value("--request="))
+            Request = V;
+        else if (const char *V = Value("--setup="))
+            Setup = V;
+        else if (Arg[0] != '-' && Socket.empty())
+            Socket = Arg;
+        else {
+            Socket.clear();
+            break;
+        }
+    }
+    if (Socket.empty() || !Sessions) {
+        fprintf(stderr, "usage: %s SOCKET [--sessions=N] [--requests=N] "
+                        "[--request=SRC] [--setup=SRC]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::vector<double>> Latencies(Sessions);
+    std::atomic<unsigned> Errors{0}, Failed{0};
+    std::string Sample;
+    std::mutex SampleLock;
+    auto RunSession = [&](unsigned I) {
+        KalConnection Conn;
+        std::string Response;
+        if (!Conn.open(Socket) || (!Setup.empty() && !Conn.request(Setup, Response))) {
+            Failed++;
+            return;
+        }
+        Latencies[I].reserve(Requests);
+        for (unsigned R = 0; R < Requests; ++R) {
+            auto Start = Clock::now();
+            if (!Conn.request(Request, Response)) {
+                Failed++;
+                return;
+            }
+            Latencies[I].push_back(std::chrono::duration<double>(Clock::now() - Start).count());
+            if (Response.compare(0, 6, "error:") == 0)
+                Errors++;
+            if (I == 0 && R == 0) {
+                std::lock_guard<std::mutex> Lock(SampleLock);
+                Sample = Response;
+            }
+        }
+    };
+
+    auto Start = Clock::now();
+    std::vector<std::thread> Threads;
+    for (unsigned I = 0; I < Sessions; ++I)
+        Threads.emplace_back(RunSession, I);
+    for (auto &T : Threads)
+        T.join();
+    double Elapsed = std::chrono::duration<double>(Clock::now() - Start).count();
+
+    std::vector<double> All;
+    for (auto &L : Latencies)
+        All.insert(All.end(), L.begin(), L.end());
+    if (All.empty()) {
+        fprintf(stderr, "%s: no request completed (is the server on %s?)\n", argv[0],
+                Socket.c_str());
+        return 1;
+    }
+    std::sort(All.begin(), All.end());
+    auto Percentile = [&](double P) {
+        return All[std::min(All.size() - 1, (size_t)(P / 100 * All.size()))] * 1e6;
+    };
+
+    printf("%u sessions, %zu requests in %.3f s: %.0f requests/s\n", Sessions, All.size(),
+           Elapsed, All.size() / Elapsed);
+    printf("latency (us): p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           Percentile(50), Percentile(90), Percentile(99), Percentile(99.9),
+           All.back() * 1e6);
+    printf("first response: %s\n", Sample.c_str());
+    if (Errors || Failed)
+        printf("%u error responses, %u sessions failed\n", Errors.load(), Failed.load());
+    return Failed ? 1 : 0;
+}
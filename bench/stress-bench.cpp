@@ -0,0 +1,129 @@
+#include<bits/stdc++.h>
+#include <pthread.h>
+#include <benchmark/benchmark.h>
+#include "../my-lang-codegen.hpp"
+#include "workload.hpp"
+
+//===----------------------------------------------------------------------===//
+// Parsing and IR generation of very long and very deeply nested expressions.
+//
+//   Parse/W/N       lexing and parsing workload W at size N
+//   IRGen/W/N       FunctionAST::codegen() of the parsed definitions
+//
+// Sizes grow by 4x and each family reports its fitted complexity, which
+// should be O(N). Everything runs on a thread with a STACK_KB (256 KiB)
+// stack, far less than a recursive walk of the larger inputs would need:
+// a crash here means something recursed on the shape of the input.
+//===----------------------------------------------------------------------===//
+
+static constexpr size_t STACK_KB = 256;
+
+/// Stressed - The workloads whose expressions grow with N, and how far.
+struct Stressed {
+    WorkloadKind Kind;
+    const char *Name;
+    int64_t MaxSize;
+};
+
+static const Stressed StressWorkloads[] = {
+    {WL_LongChain, "long-chain", 1 << 20},
+    {WL_DeepNesting, "deep-nesting", 1 << 16},
+    {WL_DeepCalls, "deep-calls", 1 << 18},
+    {WL_ManyConstants, "many-constants", 1 << 18},
+};
+
+/// parseAll - Every definition in Src, in order.
+static std::vector<std::unique_ptr<FunctionAST>> parseAll(llvm::StringRef Src) {
+    std::vector<std::unique_ptr<FunctionAST>> Defs;
+    Parser P;
+    P.getLexer().setBuffer(Src);
+    P.getNextToken();
+    while (P.getCurTok() != tok_eof) {
+        if (P.getCurTok() != tok_def) {
+            P.getNextToken();
+            continue;
+        }
+        auto FnAST = P.ParseDefinition();
+        if (!FnAST) {
+            fprintf(stderr, "stress-bench: workload failed to parse\n");
+            exit(1);
+        }
+        Defs.push_back(std::move(FnAST));
+    }
+    return Defs;
+}
+
+static size_t countNodes(const std::vector<std::unique_ptr<FunctionAST>> &Defs) {
+    size_t Nodes = 0;
+    for (auto &FnAST : Defs)
+        Nodes += FnAST->getArena().getNumNodes();
+    return Nodes;
+}
+
+static void BM_Parse(benchmark::State &State, const Stressed *W) {
+    std::string Src = generateWorkload(W->Kind, State.range(0));
+    size_t Nodes = 0;
+    for (auto _ : State)
+        Nodes += countNodes(parseAll(Src));
+    State.SetComplexityN(State.range(0));
+    State.SetBytesProcessed(State.iterations() * Src.size());
+    State.counters["nodes/s"] = benchmark::Counter(Nodes, benchmark::Counter::kIsRate);
+}
+
+static void BM_IRGen(benchmark::State &State, const Stressed *W) {
+    auto Defs = parseAll(generateWorkload(W->Kind, State.range(0)));
+    size_t Nodes = countNodes(Defs);
+    for (auto _ : State) {
+        InitializeModule();
+        for (auto &FnAST : Defs)
+            if (!FnAST->codegen()) {
+                State.SkipWithError("codegen failed");
+                return;
+            }
+    }
+    State.SetComplexityN(State.range(0));
+    State.counters["nodes/s"] = benchmark::Counter(State.iterations() * Nodes,
+                                                   benchmark::Counter::kIsRate);
+}
+
+struct MainArgs {
+    int argc;
+    char **argv;
+};
+
+static void *runBenchmarks(void *P) {
+    auto *Args = static_cast<MainArgs *>(P);
+    benchmark::Initialize(&Args->argc, Args->argv);
+    benchmark::RunSpecifiedBenchmarks();
+    return nullptr;
+}
+
+int main(int argc, char **argv) {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    for (auto &W : StressWorkloads) {
+        std::string Name = W.Name;
+        benchmark::RegisterBenchmark(("Parse/" + Name).c_str(), BM_Parse, &W)
+            ->RangeMultiplier(4)->Range(1 << 10, W.MaxSize)
+            ->Complexity(benchmark::oN)->Unit(benchmark::kMillisecond);
+        benchmark::RegisterBenchmark(("IRGen/" + Name).c_str(), BM_IRGen, &W)
+            ->RangeMultiplier(4)->Range(1 << 10, W.MaxSize)
+            ->Complexity(benchmark::oN)->Unit(benchmark::kMillisecond);
+    }
+
+    // Single-threaded benchmarks run on the thread that runs them all.
+    MainArgs Args = {argc, argv};
+    pthread_attr_t Attr;
+    pthread_attr_init(&Attr);
+    pthread_attr_setstacksize(&Attr, STACK_KB * 1024);
+    pthread_t Runner;
+    if (int Err = pthread_create(&Runner, &Attr, runBenchmarks, &Args)) {
+        fprintf(stderr, "stress-bench: cannot start benchmark thread: %s\n", strerror(Err));
+        return 1;
+    }
+    pthread_join(Runner, nullptr);
+    pthread_attr_destroy(&Attr);
+    return 0;
+}
@@ -0,0 +1,22 @@
+#include<bits/stdc++.h>
+#include "workload.hpp"
+
+//===----------------------------------------------------------------------===//
+// Print a synthetic workload, e.g. to profile the compiler on it:
+//   ./workload-gen deep-nesting 1000 | ./a.out -j 8 --stats=json
+//===----------------------------------------------------------------------===//
+
+int main(int argc, char **argv) {
+    const WorkloadInfo *W = argc > 1 ? findWorkload(argv[1]) : nullptr;
+    if (!W || argc > 4) {
+        fprintf(stderr, "usage: %s KIND [SIZE [SEED]]\nkinds:", argv[0]);
+        for (auto &Info : Workloads)
+            fprintf(stderr, " %s (default size %u)", Info.Name, Info.DefaultSize);
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    unsigned Size = argc > 2 ? atoi(argv[2]) : W->DefaultSize;
+    unsigned Seed = argc > 3 ? atoi(argv[3]) : 1;
+    fputs(generateWorkload(W->Kind, Size, Seed).c_str(), stdout);
+    return 0;
+}
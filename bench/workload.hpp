@@ -0,0 +1,201 @@
+#include<bits/stdc++.h>
+
+//===----------------------------------------------------------------------===//
+// Synthetic Kaleidoscope workloads
+//===----------------------------------------------------------------------===//
+
+/// WorkloadKind - Shapes of program that stress different parts of the
+/// compiler. Every workload is a list of definitions; Size scales it as
+/// described below.
+enum WorkloadKind {
+    /// Size short definitions, each mixing arithmetic with calls to earlier
+    /// ones: the typical library.
+    WL_ManySmall,
+    /// 16 definitions whose bodies nest parentheses and operators Size deep.
+    WL_DeepNesting,
+    /// Size leaf functions, and hubs that each call all of them.
+    WL_WideCalls,
+    /// Size definitions built from 30-40 digit numeric literals.
+    WL_LongNumbers,
+    /// Size small definitions, each under a block of comment lines.
+    WL_Comments,
+    /// One definition whose body is a flat run of Size operands joined by
+    /// operators of mixed precedence.
+    WL_LongChain,
+    /// One definition whose body nests calls and parentheses Size deep.
+    WL_DeepCalls,
+    /// One definition whose body is a sum of Size products, each with a
+    /// numeric literal of its own: stresses the tables the parser keeps
+    /// constants in.
+    WL_ManyConstants,
+};
+
+struct WorkloadInfo {
+    WorkloadKind Kind;
+    const char *Name;
+    unsigned DefaultSize;
+};
+
+static const WorkloadInfo Workloads[] = {
+    {WL_ManySmall, "many-small", 2000},
+    {WL_DeepNesting, "deep-nesting", 256},
+    {WL_WideCalls, "wide-calls", 500},
+    {WL_LongNumbers, "long-numbers", 2000},
+    {WL_Comments, "comments", 2000},
+    {WL_LongChain, "long-chain", 5000},
+    {WL_DeepCalls, "deep-calls", 2000},
+    {WL_ManyConstants, "many-constants", 5000},
+};
+
+static const WorkloadInfo *findWorkload(const std::string &Name) {
+    for (auto &W : Workloads)
+        if (Name == W.Name)
+            return &W;
+    return nullptr;
+}
+
+/// generateWorkload - A program of the given kind and size. The same
+/// arguments always give the same program.
+static std::string generateWorkload(WorkloadKind Kind, unsigned Size, unsigned Seed = 1) {
+    std::mt19937 Rng(Seed);
+    std::string Src;
+    char Buf[256];
+
+    auto operand = [&](unsigned I, const char *X, const char *Y) {
+        switch (Rng() % 4) {
+            case 0: snprintf(Buf, sizeof(Buf), "%u.5", (unsigned)(Rng() % 100)); break;
+            case 1: snprintf(Buf, sizeof(Buf), "(%s*%s - %u)", X, Y, (unsigned)(Rng() % 10)); break;
+            case 2: snprintf(Buf, sizeof(Buf), "%s", Rng() % 2 ? X : Y); break;
+            default:
+                if (I)
+                    snprintf(Buf, sizeof(Buf), "f%u(%s, %s+1)", (unsigned)(Rng() % I), X, Y);
+                else
+                    snprintf(Buf, sizeof(Buf), "%s", X);
+        }
+        Src += Buf;
+    };
+
+    auto longNumber = [&] {
+        unsigned Digits = 30 + Rng() % 11;
+        unsigned Point = 1 + Rng() % (Digits - 1);
+        for (unsigned D = 0; D < Digits; D++) {
+            if (D == Point)
+                Src += '.';
+            Src += (char)('0' + (D ? Rng() % 10 : 1 + Rng() % 9));
+        }
+    };
+
+    switch (Kind) {
+        case WL_ManySmall:
+            for (unsigned I = 0; I < Size; I++) {
+                snprintf(Buf, sizeof(Buf), "def f%u(x y) ", I);
+                Src += Buf;
+                for (unsigned T = 0; T < 8; T++) {
+                    if (T)
+                        Src += "+-*"[Rng() % 3];
+                    operand(I, "x", "y");
+                }
+                Src += ";\n";
+            }
+            break;
+
+        case WL_DeepNesting:
+            for (unsigned I = 0; I < 16; I++) {
+                snprintf(Buf, sizeof(Buf), "def deep%u(x y) ", I);
+                Src += Buf;
+                for (unsigned D = 0; D < Size; D++) {
+                    Src += Rng() % 2 ? "x" : "y";
+                    Src += "+-*"[Rng() % 3];
+                    Src += '(';
+                }
+                snprintf(Buf, sizeof(Buf), "%u.25", (unsigned)(Rng() % 100));
+                Src += Buf;
+                Src += std::string(Size, ')');
+                Src += ";\n";
+            }
+            break;
+
+        case WL_WideCalls:
+            for (unsigned I = 0; I < Size; I++) {
+                snprintf(Buf, sizeof(Buf), "def leaf%u(x) x*%u.5 - %u;\n", I,
+                         (unsigned)(Rng() % 100), (unsigned)(Rng() % 10));
+                Src += Buf;
+            }
+            for (unsigned H = 0; H < 4; H++) {
+                snprintf(Buf, sizeof(Buf), "def hub%u(x) ", H);
+                Src += Buf;
+                for (unsigned I = 0; I < Size; I++) {
+                    snprintf(Buf, sizeof(Buf), "%sleaf%u(x)", I ? "+" : "", I);
+                    Src += Buf;
+                }
+                Src += ";\n";
+            }
+            break;
+
+        case WL_LongNumbers:
+            for (unsigned I = 0; I < Size; I++) {
+                snprintf(Buf, sizeof(Buf), "def n%u(x) ", I);
+                Src += Buf;
+                for (unsigned T = 0; T < 6; T++) {
+                    if (T)
+                        Src += T % 2 ? "*x+" : "-";
+                    longNumber();
+                }
+                Src += ";\n";
+            }
+            break;
+
+        case WL_Comments:
+            for (unsigned I = 0; I < Size; I++) {
+                for (unsigned L = 0, E = 2 + Rng() % 6; L < E; L++) {
+                    snprintf(Buf, sizeof(Buf),
+                             "# %u.%u: returns a blend of its arguments; see the notes above c%u\n",
+                             I, L, I ? (unsigned)(Rng() % I) : 0);
+                    Src += Buf;
+                }
+                snprintf(Buf, sizeof(Buf), "def c%u(a b) a*%u.5 + b - %u; # trailing remark\n",
+                         I, (unsigned)(Rng() % 100), (unsigned)(Rng() % 10));
+                Src += Buf;
+            }
+            break;
+
+        case WL_LongChain:
+            Src += "def chain(x y) ";
+            for (unsigned I = 0; I < Size; I++) {
+                if (I)
+                    Src += "+-*"[Rng() % 3];
+                operand(0, "x", "y");
+            }
+            Src += ";\n";
+            break;
+
+        case WL_DeepCalls:
+            Src += "def step(a b) a*0.5 + b;\n";
+            Src += "def nest(x) ";
+            for (unsigned D = 0; D < Size; D++) {
+                if (Rng() % 2) {
+                    snprintf(Buf, sizeof(Buf), "step(%u.5, ", (unsigned)(Rng() % 10));
+                    Src += Buf;
+                } else {
+                    Src += "x-(";
+                }
+            }
+            Src += "x";
+            Src += std::string(Size, ')');
+            Src += ";\n";
+            break;
+
+        case WL_ManyConstants:
+            // Integers and halves, whose doubles differ only in their top
+            // bits, as most literals in real programs do.
+            Src += "def consts(x) ";
+            for (unsigned I = 0; I < Size; I++) {
+                snprintf(Buf, sizeof(Buf), "%sx*%u%s", I ? " + " : "", I / 2,
+                         I % 2 ? ".5" : "");
+                Src += Buf;
+            }
+            Src += ";\n";
+            break;
+    }
+    return Src;
+}
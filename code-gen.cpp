@@ -1,255 +1,543 @@
 #include<bits/stdc++.h>
-#include "my-lang-parser.hpp"
-//#include "/usr/include/KaleidoscopeJIT.h"
-#include "llvm/IR/LegacyPassManager.h"
-#include "llvm/Support/TargetSelect.h"
-#include "llvm/Target/TargetMachine.h"
-#include "llvm/Transforms/InstCombine/InstCombine.h"
-#include "llvm/Transforms/Scalar.h"
-#include "llvm/Transforms/Scalar/GVN.h"
-#include "llvm/Pass.h"
-
-//using namespace llvm::orc;
+#include "my-lang-server.hpp"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/Support/ThreadPool.h"
 
 
 //===----------------------------------------------------------------------===//
-// Code Generation
+// Command line
 //===----------------------------------------------------------------------===//
 
-//llvm declarations
-static std::unique_ptr<llvm::LLVMContext> TheContext;
-static std::unique_ptr<llvm::Module> TheModule;
-static std::unique_ptr<llvm::IRBuilder<>> Builder;
-static std::map<std::string, llvm::Value *> NamedValues;
-
-
-llvm::Value *LogErrorV(const char *Str) {
-  LogError(Str);
-  return nullptr;
-}
-
-
-//===----------------------------------------------------------------------===//
-// For Optimization Pass Manager method
-//===----------------------------------------------------------------------===//
-
-static std::unique_ptr<llvm::legacy::FunctionPassManager> TheFPM;
-//static std::unique_ptr<KaleidoscopeJIT> TheJIT;
-static std::map<std::string, std::unique_ptr<PrototypeAST>> FunctionProtos;
-static llvm::ExitOnError ExitOnErr;
-
-// --------------------------------------------------------------------------------------------------
-//---------------------------------------------------------------------------------------------------
-
-llvm::Value *NumberExprAST::codegen() {
-    return llvm::ConstantFP::get(*TheContext, llvm::APFloat(Val));
+/// NumJobs - Compile threads (-j N). Zero compiles on the main thread as the
+/// REPL always has; anything else selects batch mode.
+static unsigned NumJobs = 0;
+static std::string InputFilename;
+
+/// CompileOnly - -c: compile the input ahead of time into OutputFilename (an
+/// object file, or a shared library if it ends in ".so") instead of running
+/// it. SingleModule puts every function into one module so that they can be
+/// optimized, and inlined into each other, together.
+static bool CompileOnly = false;
+static bool SingleModule = false;
+static std::string OutputFilename = "output.o";
+
+/// CacheDir - --cache-dir: where the JIT keeps compiled definitions between
+/// runs (see FunctionCache). Empty for no cache.
+static std::string CacheDir;
+
+/// Lazy - --lazy: hand definitions to the JIT as they are read but optimize
+/// and compile each only when it is first called, so that a run pays only for
+/// the functions it uses. Precompile - --precompile: definitions expected to
+/// be hot, compiled in the background as soon as they are read instead.
+static bool Lazy = false;
+static llvm::DenseSet<Symbol> Precompile;
+
+/// Tiered - --tiered: interpret definitions and top-level expressions, and
+/// compile a function with the JIT once calls to it and iterations of its
+/// loops reach TierUpThreshold.
+static bool Tiered = false;
+
+/// PGO - --pgo: run definitions instrumented and re-optimize each with its
+/// profile once it is hot (see my-lang-pgo.hpp). ProfileOut - --profile-out:
+/// also write the profile there at exit. ProfileUse - --profile-use: with
+/// -c, optimize with a profile written that way.
+static bool PGO = false;
+static std::string ProfileOut, ProfileUse;
+
+/// ServeSocket - --serve: after loading the program as a library, serve
+/// sessions on this Unix domain socket (see my-lang-server.hpp).
+static std::string ServeSocket;
+
+/// PerfMode - --perf: how JIT'd functions are made known to perf. "map"
+/// lists them in /tmp/perf-PID.map, which perf report reads as is;
+/// "jitdump" has LLVM write jit-PID.dump, which also carries the code, under
+/// $JITDUMPDIR or ~/.debug/jit, for perf record -k 1 and perf inject --jit.
+static std::string PerfMode;
+
+/// GDBJIT - --gdb-jit: register JIT'd objects with GDB's JIT interface.
+static bool GDBJIT = false;
+
+/// NumAnonExprs - Top-level expressions run so far. Each is compiled under a
+/// name of its own so that profiles can tell them apart.
+static unsigned NumAnonExprs = 0;
+
+static const char *Usage =
+    "usage: %s [options] [file]\n"
+    "  -O0 .. -O3         optimization level (default -O2; -O0 skips it,\n"
+    "                     front-end simplification included)\n"
+    "  -j N, --jobs=N     optimize and compile on N threads (batch mode)\n"
+    "  -c                 compile to an object file instead of running\n"
+    "  -o FILE            output for -c; FILE.so builds a shared library\n"
+    "  --single-module    with -c, put all functions in one module\n"
+    "  --lazy             compile each definition when it is first called\n"
+    "  --precompile=F,G   with --lazy, compile F, G in the background up front\n"
+    "  --tiered[=N]       interpret, compiling functions after N calls or\n"
+    "                     loop iterations (1000)\n"
+    "  --memoize[=F,G]    cache the results of pure functions that call\n"
+    "                     functions, or of F, G\n"
+    "  --specialize[=N]   call clones of functions with constant arguments\n"
+    "                     folded in, up to N per function (4)\n"
+    "  --pgo[=N]          profile definitions as they run, and re-optimize\n"
+    "                     each with its profile after N calls (10000)\n"
+    "  --profile-out=FILE with --pgo, write the profile to FILE at exit\n"
+    "  --profile-use=FILE with -c, optimize with the profile in FILE\n"
+    "  -mcpu=CPU          generate code for CPU (default native: this machine)\n"
+    "  -mattr=+F,-G       enable feature F and disable G on top of the CPU's\n"
+    "  --fast-math        let the optimizer assume no NaNs, infinities or\n"
+    "                     signed zeros, reassociate and fuse operations\n"
+    "  --reassoc          allow reordering sums and products\n"
+    "  --fp-contract=fast|off\n"
+    "                     fuse multiplies and adds into FMAs (default off)\n"
+    "  --veclib=libmvec|svml|none\n"
+    "                     vector math library for vectorized calls to libm\n"
+    "  --perf=map|jitdump tell perf the names of JIT'd functions\n"
+    "  --gdb-jit          register JIT'd code with GDB\n"
+    "  --cache-dir=DIR    reuse definitions compiled by earlier runs from DIR\n"
+    "  --stats=json       print per-function compile statistics to stdout\n"
+    "  --serve=SOCKET     load the program as a library, then serve sessions\n"
+    "                     that evaluate source against it on SOCKET\n";
+
+/// matchValueOption - Match an option that takes a value, spelled "-x V",
+/// "-xV" or "--long=V". Steps i past a separate value.
+static bool matchValueOption(llvm::StringRef Arg, llvm::StringRef Short,
+                             llvm::StringRef Long, int &i, int argc,
+                             char **argv, llvm::StringRef &Value) {
+  if (!Long.empty() && Arg.consume_front(Long)) {
+    Value = Arg;
+    return true;
+  }
+  if (Short.empty() || !Arg.consume_front(Short))
+    return false;
+  if (!Arg.empty()) {
+    Value = Arg;
+    return true;
+  }
+  if (i + 1 >= argc)
+    return false;
+  Value = argv[++i];
+  return true;
 }
 
-llvm::Value *VariableExprAST::codegen() {
-    //Look this variable up in the function.
-    llvm::Value *V = NamedValues[Name];
-    if(!V){
-        LogError("Unknown variable name.");
+static bool ParseCommandLine(int argc, char **argv) {
+  for (int i = 1; i < argc; ++i) {
+    llvm::StringRef Arg = argv[i], Value;
+    if (matchValueOption(Arg, "-j", "--jobs=", i, argc, argv, Value)) {
+      if (Value.getAsInteger(10, NumJobs)) {
+        fprintf(stderr, "Error: invalid job count '%s'\n", Value.str().c_str());
+        return false;
+      }
+    } else if (Arg.size() == 3 && Arg.startswith("-O") && Arg[2] >= '0' && Arg[2] <= '3')
+      OptLevel = Arg[2] - '0';
+    else if (matchValueOption(Arg, "-o", "", i, argc, argv, Value))
+      OutputFilename = Value.str();
+    else if (Arg == "-c")
+      CompileOnly = true;
+    else if (Arg == "--single-module")
+      SingleModule = true;
+    else if (Arg == "--lazy")
+      Lazy = true;
+    else if (matchValueOption(Arg, "", "--precompile=", i, argc, argv, Value)) {
+      llvm::SmallVector<llvm::StringRef, 8> Names;
+      Value.split(Names, ',', -1, /*KeepEmpty=*/false);
+      for (llvm::StringRef Name : Names)
+        Precompile.insert(internSymbol(Name));
+      Lazy = true;
     }
-    return V;
-}
-
-
-llvm::Value *BinaryExprAST::codegen(){
-    llvm::Value *L = LHS->codegen();
-    llvm::Value *R = RHS->codegen();
-    if(!L||!R)
-        return nullptr;
-    
-    switch(Op) {
-        case '+':
-            return Builder->CreateFAdd(L,R,"addtmp");
-        case '-':
-            return Builder->CreateFSub(L,R,"subtmp");
-        case '*':
-            return Builder->CreateFMul(L,R,"multmp");
-        case '<':
-            return Builder->CreateFCmpULT(L,R,"cmptmp");
-            //convert bool 0/1 to double 0.0 or 1.0
-            return Builder->CreateUIToFP(L, llvm::Type::getDoubleTy(*TheContext),"booltmp");
-
-        default:
-            return LogErrorV("invlid binary operator");    
+    else if (Arg == "--tiered")
+      Tiered = true;
+    else if (matchValueOption(Arg, "", "--tiered=", i, argc, argv, Value)) {
+      if (Value.getAsInteger(10, TierUpThreshold)) {
+        fprintf(stderr, "Error: invalid call count '%s'\n", Value.str().c_str());
+        return false;
+      }
+      Tiered = true;
     }
-}
-
-
-
-llvm::Value *CallExprAST::codegen() {
-    //Lookup the name in the global module table
-    llvm::Function *CalleeF = TheModule->getFunction(Callee);
-    if(!CalleeF)
-        return LogErrorV("Unknown function referenced");
-    
-    //If argument mismatch error
-    if(CalleeF->arg_size() != Args.size())
-        return LogErrorV("Incorrect # arguments passed");
-
-    std::vector<llvm::Value *> ArgsV;
-    for( unsigned i=0,e=Args.size();i!=e;i++){
-        ArgsV.push_back(Args[i]->codegen());
-        if(!ArgsV.back())
-            return nullptr;
+    else if (matchValueOption(Arg, "", "-mcpu=", i, argc, argv, Value))
+      TargetCPU = Value.str();
+    else if (matchValueOption(Arg, "", "-mattr=", i, argc, argv, Value))
+      TargetAttrs = Value.str();
+    else if (Arg == "--fast-math")
+      FPFlags.setFast();
+    else if (Arg == "--reassoc")
+      FPFlags.setAllowReassoc();
+    else if (matchValueOption(Arg, "", "--fp-contract=", i, argc, argv, Value)) {
+      if (Value != "fast" && Value != "off") {
+        fprintf(stderr, "Error: unknown contraction mode '%s'\n", Value.str().c_str());
+        return false;
+      }
+      FPFlags.setAllowContract(Value == "fast");
     }
-
-    return Builder->CreateCall(CalleeF, ArgsV, "calltmp");
-    
+    else if (Arg == "--memoize")
+      MemoizeInferred = true;
+    else if (matchValueOption(Arg, "", "--memoize=", i, argc, argv, Value)) {
+      llvm::SmallVector<llvm::StringRef, 8> Names;
+      Value.split(Names, ',', -1, /*KeepEmpty=*/false);
+      for (llvm::StringRef Name : Names)
+        MemoizeNames.insert(internSymbol(Name));
+    }
+    else if (Arg == "--specialize")
+      MaxSpecializations = 4;
+    else if (matchValueOption(Arg, "", "--specialize=", i, argc, argv, Value)) {
+      if (Value.getAsInteger(10, MaxSpecializations)) {
+        fprintf(stderr, "Error: invalid clone count '%s'\n", Value.str().c_str());
+        return false;
+      }
+    }
+    else if (Arg == "--pgo")
+      PGO = true;
+    else if (matchValueOption(Arg, "", "--pgo=", i, argc, argv, Value)) {
+      if (Value.getAsInteger(10, ReoptThreshold)) {
+        fprintf(stderr, "Error: invalid call count '%s'\n", Value.str().c_str());
+        return false;
+      }
+      PGO = true;
+    }
+    else if (matchValueOption(Arg, "", "--profile-out=", i, argc, argv, Value)) {
+      ProfileOut = Value.str();
+      PGO = true;
+    }
+    else if (matchValueOption(Arg, "", "--profile-use=", i, argc, argv, Value))
+      ProfileUse = Value.str();
+    else if (matchValueOption(Arg, "", "--veclib=", i, argc, argv, Value)) {
+      if (auto Err = setVecLib(Value)) {
+        fprintf(stderr, "Error: %s\n", llvm::toString(std::move(Err)).c_str());
+        return false;
+      }
+    }
+    else if (matchValueOption(Arg, "", "--perf=", i, argc, argv, Value)) {
+      if (Value != "map" && Value != "jitdump") {
+        fprintf(stderr, "Error: unknown perf mode '%s'\n", Value.str().c_str());
+        return false;
+      }
+      PerfMode = Value.str();
+    }
+    else if (Arg == "--gdb-jit")
+      GDBJIT = true;
+    else if (matchValueOption(Arg, "", "--cache-dir=", i, argc, argv, Value))
+      CacheDir = Value.str();
+    else if (matchValueOption(Arg, "", "--stats=", i, argc, argv, Value)) {
+      if (Value != "json") {
+        fprintf(stderr, "Error: unknown statistics format '%s'\n", Value.str().c_str());
+        return false;
+      }
+      TheStats = std::make_unique<CompileStats>();
+    }
+    else if (matchValueOption(Arg, "", "--serve=", i, argc, argv, Value))
+      ServeSocket = Value.str();
+    else if (Arg == "-h" || Arg == "--help") {
+      fprintf(stderr, Usage, argv[0]);
+      exit(0);
+    }
+    else if (Arg.startswith("-") || !InputFilename.empty()) {
+      fprintf(stderr, Usage, argv[0]);
+      return false;
+    } else
+      InputFilename = Arg.str();
+  }
+  bool Memoize = MemoizeInferred || !MemoizeNames.empty();
+  // Instrumentation covers every function in a definition's module, clones
+  // included, but only the definition's own counters are lowered.
+  if (PGO && (CompileOnly || Lazy || Tiered || Memoize || MaxSpecializations ||
+              !CacheDir.empty())) {
+    fprintf(stderr, "Error: --pgo cannot be combined with -c, --lazy, --tiered, --memoize, "
+                    "--specialize or --cache-dir\n");
+    return false;
+  }
+  // Memoized functions keep their caches in this process.
+  if (Memoize && CompileOnly) {
+    fprintf(stderr, "Error: --memoize cannot be combined with -c\n");
+    return false;
+  }
+  // Sessions generate code for themselves, on the main JITDylib's terms.
+  if (!ServeSocket.empty() && (CompileOnly || NumJobs || Lazy || Tiered || PGO || Memoize)) {
+    fprintf(stderr, "Error: --serve cannot be combined with -c, -j, --lazy, --tiered, --pgo "
+                    "or --memoize\n");
+    return false;
+  }
+  if (!ProfileUse.empty() && !CompileOnly) {
+    fprintf(stderr, "Error: --profile-use needs -c\n");
+    return false;
+  }
+  return true;
 }
 
-llvm::Function *PrototypeAST::codegen(){
-    //Make the function type: double(double,double) etc.
-    std::vector<llvm::Type*> Doubles (Args.size(), llvm::Type::getDoubleTy(*TheContext));
-
-    llvm::FunctionType *FT = llvm::FunctionType::get(llvm::Type::getDoubleTy(*TheContext),Doubles, false);
-
-    llvm::Function *F = llvm::Function::Create(FT,llvm::Function::ExternalLinkage, Name,TheModule.get());
+/// isBatch - Whether we are processing a whole program rather than talking
+/// to a user, in which case there are no prompts or IR dumps.
+static bool isBatch() { return NumJobs || CompileOnly || !ServeSocket.empty(); }
 
-    //set the names for all the arguments
-    unsigned Idx = 0;
-    for(auto &Arg : F->args())
-        Arg.setName(Args[Idx++]);
-    
-    return F;
+/// takeModule - Hand TheModule over for compilation, named after the function
+/// it defines so that --stats can attribute its optimization and code
+/// generation to that function.
+static llvm::orc::ThreadSafeModule takeModule(llvm::StringRef Name) {
+  TheModule->setModuleIdentifier(Name);
+  return llvm::orc::ThreadSafeModule(std::move(TheModule), std::move(TheContext));
 }
 
 
-llvm::Function *FunctionAST::codegen(){
-    // First, check for an existing function from a previous 'extern' declaration.
-
-    llvm::Function *TheFunction = TheModule->getFunction(Proto->getName());
-    if(!TheFunction)
-        TheFunction = Proto->codegen();
-    
-    if(!TheFunction)
-        return nullptr;
-    
-    if(!TheFunction->empty())
-        return (llvm::Function*)LogErrorV("Function cannot be redefined.");
-    
-    //Create a new basic block
-    llvm::BasicBlock *BB = llvm::BasicBlock::Create(*TheContext, "entry", TheFunction);
-    Builder->SetInsertPoint(BB);
-
-    // Record the function arguments in the NamedValues map.
-    NamedValues.clear();
-    for (auto &Arg : TheFunction->args())
-        NamedValues[ std::string(Arg.getName()) ] = &Arg;
-    
-    if(llvm::Value *RetVal = Body->codegen()){
-        //Finish off the function.
-        Builder->CreateRet(RetVal);
-
-        //Validate the generated code, checking for consistency.
-        llvm::verifyFunction(*TheFunction);
-
-        // Optimize the function.
-        TheFPM->run(*TheFunction);
+//===----------------------------------------------------------------------===//
+// Ahead-of-time driver
+//===----------------------------------------------------------------------===//
 
-        return TheFunction;
+/// AOTModules - With -c, the modules generated so far. They are optimized and
+/// compiled together at the end of input by EmitObjectFile().
+static std::vector<llvm::orc::ThreadSafeModule> AOTModules;
+
+/// EmitObjectFile - Optimize and compile AOTModules, on NumJobs threads if
+/// asked to, and write the result to OutputFilename.
+static llvm::Error EmitObjectFile() {
+  // With --single-module everything was generated into TheModule. Otherwise
+  // it holds at most extern declarations by now, which emit nothing.
+  if (SingleModule)
+    AOTModules.push_back(takeModule(OutputFilename));
+
+  std::vector<ObjectImage> Objects(AOTModules.size());
+  std::mutex ErrLock;
+  llvm::Error Err = llvm::Error::success();
+
+  auto Compile = [&](size_t I) {
+    // TargetMachines are not thread-safe: each thread gets its own.
+    static thread_local std::unique_ptr<llvm::TargetMachine> TM;
+    llvm::Error E = llvm::Error::success();
+    if (!TM) {
+      auto TMOrErr = createHostTargetMachine(getCodeGenOptLevel(), getTargetOptions());
+      if (TMOrErr)
+        TM = std::move(*TMOrErr);
+      else
+        E = TMOrErr.takeError();
     }
+    if (TM)
+      AOTModules[I].withModuleDo([&](llvm::Module &M) {
+        if (!ProfileUse.empty() && OptLevel != 0)
+          applyProfile(M, ProfileUse);
+        optimizeModule(M, TM.get());
+        auto Start = StatsClock::now();
+        E = emitObject(*TM, M, Objects[I]);
+        if (TheStats && !E)
+          recordCodeGen(M, secondsSince(Start), Objects[I].size());
+      });
+    if (E) {
+      std::lock_guard<std::mutex> Lock(ErrLock);
+      Err = llvm::joinErrors(std::move(Err), std::move(E));
+    }
+  };
 
-    //Error reading the body, remove function
-    TheFunction->eraseFromParent();
-    return nullptr;
+  if (NumJobs) {
+    llvm::ThreadPool Pool(llvm::hardware_concurrency(NumJobs));
+    for (size_t I = 0; I != AOTModules.size(); ++I)
+      Pool.async(Compile, I);
+    Pool.wait();
+  } else {
+    for (size_t I = 0; I != AOTModules.size(); ++I)
+      Compile(I);
+  }
+  if (Err)
+    return Err;
 
+  return linkObjects(Objects, OutputFilename);
 }
 
+
 //===----------------------------------------------------------------------===//
 // Top-Level parsing and JIT Driver
 //===----------------------------------------------------------------------===//
 
-// static void InitializeModule() {
-//   // Open a new context and module.
-//   TheContext = std::make_unique<llvm::LLVMContext>();
-//   TheModule = std::make_unique<llvm::Module>("my cool jit", *TheContext);
-
-//   // Create a new builder for the module.
-//   Builder = std::make_unique<llvm::IRBuilder<>>(*TheContext);
-// }
-
-
-//Pass Manager for Optimization
-static void InitializeModuleAndPassManager() {
-  // Open a new context and module.
-  TheContext = std::make_unique<llvm::LLVMContext>();
-  TheModule = std::make_unique<llvm::Module>("my cool jit", *TheContext);
-  //TheModule->setDataLayout(TheJIT->getDataLayout());
-
-  // Create a new builder for the module.
-  Builder = std::make_unique<llvm::IRBuilder<>>(*TheContext);
-
-  // Create a new pass manager attached to it.
-  TheFPM = std::make_unique<llvm::legacy::FunctionPassManager>(TheModule.get());
-
-  // Do simple "peephole" optimizations and bit-twiddling optzns.
-  TheFPM->add(llvm::createInstructionCombiningPass());
-  // Reassociate expressions.
-  TheFPM->add(llvm::createReassociatePass());
-  // Eliminate Common SubExpressions.
-  TheFPM->add(llvm::createGVNPass());
-  // Simplify the control flow graph (deleting unreachable blocks, etc).
-  TheFPM->add(llvm::createCFGSimplificationPass());
+/// TheParser - Reads the program: the file named on the command line, or
+/// stdin.
+static Parser TheParser;
+
+/// PendingDefs - In batch mode, definitions handed to the JIT but not compiled
+/// yet. They are compiled together by FlushPendingDefinitions().
+static std::vector<Symbol> PendingDefs;
+
+static void FlushPendingDefinitions() {
+  if (PendingDefs.empty())
+    return;
+  std::vector<llvm::StringRef> Names;
+  for (Symbol S : PendingDefs)
+    Names.push_back(getSymbolName(S));
+  ExitOnErr(TheJIT->materialize(Names));
+  PendingDefs.clear();
+}
 
-  TheFPM->doInitialization();
+/// loadCachedDefinition - Link the object TheCache holds under Key for FnAST
+/// instead of compiling FnAST. False if there is none.
+static bool loadCachedDefinition(const FunctionAST &FnAST, llvm::StringRef Key) {
+  auto Obj = TheCache->lookup(Key);
+  if (!Obj)
+    return false;
+
+  // Later definitions still need the prototype to call it.
+  auto &P = FnAST.getProto();
+  FunctionProtos[P.getSymbol()] = std::make_unique<PrototypeAST>(P);
+  if (!isBatch())
+    fprintf(stderr, "Read function definition: %s (cached)\n", P.getName().str().c_str());
+  if (NumJobs && !Lazy)
+    PendingDefs.push_back(P.getSymbol());
+  ExitOnErr(TheJIT->addObjectFile(std::move(Obj)));
+  return true;
 }
 
 static void HandleDefinition() {
-  if (auto FnAST = ParseDefinition()) {
+  FrontEndTimer Timer(TheParser.getLexSeconds());
+  if (auto FnAST = TheParser.ParseDefinition()) {
+    Timer.parsed();
+    Symbol S = FnAST->getProto().getSymbol();
+    // Each definition gets a module of its own, so the code generator would
+    // not notice: the JIT would, fatally.
+    if (FunctionDefs.count(S)) {
+      LogError("Function cannot be redefined.");
+      return;
+    }
+    planMemoization(*FnAST);
+    if (Tiered && !CompileOnly) {
+      size_t Nodes = FnAST->getArena().getNumNodes();
+      if (defineTiered(std::move(FnAST))) {
+        Timer.generated(getSymbolName(S), Nodes);
+        if (!isBatch())
+          fprintf(stderr, "Read function definition: %s (interpreted)\n",
+                  getSymbolName(S).str().c_str());
+      }
+      return;
+    }
+    std::string CacheKey;
+    // A memoized function's code points at its cache in this process; a
+    // clone is of its callee as defined in this run.
+    if (TheCache && !MemoTables.count(S) && !mayCallSpecialization(*FnAST)) {
+      CacheKey = TheCache->getKey(*FnAST);
+      if (!CacheKey.empty() && loadCachedDefinition(*FnAST, CacheKey)) {
+        Timer.generated(FnAST->getProto().getName(), FnAST->getArena().getNumNodes(),
+                        /*CacheHit=*/true);
+        FunctionDefs[FnAST->getProto().getSymbol()] = std::move(FnAST);
+        return;
+      }
+    }
     if (auto *FnIR = FnAST->codegen()) {
-      fprintf(stderr, "Read function definition:\n");
-      FnIR->print(llvm::errs());
-      fprintf(stderr, "\n");
+      llvm::StringRef Name = FnAST->getProto().getName();
+      Timer.generated(Name, FnAST->getArena().getNumNodes());
+      if (!isBatch()) {
+        fprintf(stderr, "Read function definition:\n");
+        FnIR->print(llvm::errs());
+        fprintf(stderr, "\n");
+      }
+      if (CompileOnly) {
+        if (!SingleModule) {
+          AOTModules.push_back(takeModule(Name));
+          InitializeModule();
+        }
+        FunctionDefs[S] = std::move(FnAST);
+        return;
+      }
+      if (!CacheKey.empty())
+        FunctionCache::setKey(*TheModule, CacheKey);
+      if (PGO) {
+        // Callers go through a stub that can be pointed at a re-optimized
+        // version later.
+        std::string Impl = (Name + ".instr").str();
+        instrumentDefinition(*TheModule, Name);
+        ExitOnErr(TheJIT->addRedirectableModule(takeModule(Name), Name, Impl));
+        if (NumJobs)
+          PendingDefs.push_back(internSymbol(Impl));
+      } else if (Lazy && !Precompile.count(S)) {
+        ExitOnErr(TheJIT->addLazyModule(takeModule(Name)));
+      } else {
+        ExitOnErr(TheJIT->addModule(takeModule(Name)));
+        if (Lazy)
+          TheJIT->materializeAsync(Name);
+        else if (NumJobs)
+          PendingDefs.push_back(S);
+      }
+      InitializeModule();
+      FunctionDefs[S] = std::move(FnAST);
     }
   } else {
     // Skip token for error recovery.
-    getNextToken();
+    TheParser.getNextToken();
   }
 }
 
 static void HandleExtern() {
-  if (auto ProtoAST = ParseExtern()) {
+  FrontEndTimer Timer(TheParser.getLexSeconds());
+  if (auto ProtoAST = TheParser.ParseExtern()) {
+    Timer.parsed();
     if (auto *FnIR = ProtoAST->codegen()) {
-      fprintf(stderr, "Read extern:\n");
-      FnIR->print(llvm::errs());
-      fprintf(stderr, "\n");
+      Timer.generated(ProtoAST->getName(), 0);
+      if (!isBatch()) {
+        fprintf(stderr, "Read extern:\n");
+        FnIR->print(llvm::errs());
+        fprintf(stderr, "\n");
+      }
+      Externs.insert(ProtoAST->getSymbol());
+      FunctionProtos[ProtoAST->getSymbol()] = std::move(ProtoAST);
     }
   } else {
     // Skip token for error recovery.
-    getNextToken();
+    TheParser.getNextToken();
   }
 }
 
 static void HandleTopLevelExpression() {
   // Evaluate a top-level expression into an anonymous function.
-  if (auto FnAST = ParseTopLevelExpr()) {
+  FrontEndTimer Timer(TheParser.getLexSeconds());
+  if (auto FnAST = TheParser.ParseTopLevelExpr()) {
+    Timer.parsed();
+    if (CompileOnly) {
+      fprintf(stderr, "Ignoring top-level expression: nothing runs with -c.\n");
+      return;
+    }
+    if (Tiered) {
+      double Result = 0;
+      if (evaluateTiered(*FnAST, Result)) {
+        Timer.generated(FnAST->getProto().getName(), FnAST->getArena().getNumNodes());
+        fprintf(stderr, "Evaluated to %f\n", Result);
+      }
+      return;
+    }
     if (auto *FnIR = FnAST->codegen()) {
-      fprintf(stderr, "Read top-level expression:\n");
-      FnIR->print(llvm::errs());
-      fprintf(stderr, "\n");
+      Timer.generated(FnAST->getProto().getName(), FnAST->getArena().getNumNodes());
+      std::string Name = ("__anon_expr." + llvm::Twine(NumAnonExprs++)).str();
+      FnIR->setName(Name);
+
+      // Compile the definitions read so far in parallel before running code
+      // that may need them, and let --precompile's background compiles end.
+      FlushPendingDefinitions();
+      if (!Precompile.empty())
+        TheJIT->waitForCompiles();
+
+      // Create a ResourceTracker to track JIT'd memory allocated to our
+      // anonymous expression -- that way we can free it after executing.
+      auto RT = TheJIT->getMainJITDylib().createResourceTracker();
 
-      // Remove the anonymous expression.
-      FnIR->eraseFromParent();
+      ExitOnErr(TheJIT->addModule(takeModule(FnAST->getProto().getName()), RT));
+      InitializeModule();
+
+      // Search the JIT for the expression's symbol.
+      auto ExprSymbol = ExitOnErr(TheJIT->lookup(Name));
+
+      // Get the symbol's address and cast it to the right type (takes no
+      // arguments, returns a double) so we can call it as a native function.
+      double (*FP)() = (double (*)())(intptr_t)ExprSymbol.getAddress();
+      fprintf(stderr, "Evaluated to %f\n", FP());
+
+      // Delete the anonymous expression module from the JIT.
+      ExitOnErr(TheJIT->removeModule(RT));
     }
   } else {
     // Skip token for error recovery.
-    getNextToken();
+    TheParser.getNextToken();
   }
 }
 
 /// top ::= definition | external | expression | ';'
 static void MainLoop() {
   while (true) {
-    fprintf(stderr, "ready> ");
-    switch (CurTok) {
+    if (!isBatch())
+      fprintf(stderr, "ready> ");
+    switch (TheParser.getCurTok()) {
     case tok_eof:
+      FlushPendingDefinitions();
       return;
     case ';': // ignore top-level semicolons.
-      getNextToken();
+      TheParser.getNextToken();
       break;
     case tok_def:
       HandleDefinition();
@@ -265,24 +553,95 @@ static void MainLoop() {
 }
 
 
-int main() {
+int main(int argc, char **argv) {
     llvm::InitializeNativeTarget();
     llvm::InitializeNativeTargetAsmPrinter();
     llvm::InitializeNativeTargetAsmParser();
     
+    ExitOnErr.setBanner(std::string(argv[0]) + ": ");
+    if (!ParseCommandLine(argc, argv))
+        return 1;
+    ExitOnErr(checkTargetCPU());
+    if (TargetCPU == "help")
+        return 0;
+
+    // Read the program from the named file (mapped into memory), otherwise
+    // stream it from stdin.
+    if (!InputFilename.empty() && !TheParser.getLexer().setFile(InputFilename))
+        return 1;
+    // -O0 means no optimization at all, the front end's included.
+    TheParser.setSimplify(OptLevel > 0);
     
-    fprintf(stderr, "ready>");
-    getNextToken();
+    if (!isBatch())
+        fprintf(stderr, "ready>");
+    TheParser.getNextToken();
+
+    if (CompileOnly)
+        TheTargetMachine = ExitOnErr(createHostTargetMachine(getCodeGenOptLevel(), getTargetOptions()));
+    else {
+        KaleidoscopeJIT::Options Opts;
+        // Background compiles need a thread to run on.
+        Opts.NumCompileThreads = NumJobs ? NumJobs : !Precompile.empty();
+        Opts.OptimizeModule = optimizeModule;
+        Opts.CodeGenOptLevel = getCodeGenOptLevel();
+        Opts.TargetOptions = getTargetOptions();
+        Opts.CPU = getTargetCPU();
+        Opts.Features = getTargetFeatures().getString();
+        if (TheStats)
+            Opts.NotifyCompiled = recordCodeGen;
+        if (!CacheDir.empty()) {
+            TheCache = ExitOnErr(FunctionCache::Create(CacheDir));
+            Opts.ObjCache = TheCache.get();
+        }
+        TheJIT = ExitOnErr(KaleidoscopeJIT::Create(Opts));
+        // Listeners are leaked: the JIT may call them until it is destroyed.
+        if (PerfMode == "map")
+            ExitOnErr(TheJIT->addEventListener(*new PerfMapListener()));
+        else if (PerfMode == "jitdump") {
+            auto *L = llvm::JITEventListener::createPerfJITEventListener();
+            if (!L) {
+                fprintf(stderr, "Error: this LLVM was built without perf support\n");
+                return 1;
+            }
+            ExitOnErr(TheJIT->addEventListener(*L));
+        }
+        if (GDBJIT)
+            ExitOnErr(TheJIT->addEventListener(
+                *llvm::JITEventListener::createGDBRegistrationListener()));
+        if (TheCache)
+            TheCache->setConfiguration(TheJIT->getTargetDescription() + " -O" +
+                                       std::to_string(OptLevel) + " " +
+                                       getFPModeDescription() + " veclib=" + VecLibName);
+    }
 
-    //InitializeModule();
-    InitializeModuleAndPassManager();
+    InitializeModule();
+    if (PGO)
+        startReoptimizer();
 
     //run the main "interpreter loop" now.
     MainLoop();
 
-    // Print out all of the generated code.
-    TheModule->print(llvm::errs(), nullptr);
-    
+    if (!ServeSocket.empty()) {
+        // Compile the whole library before the first session needs it.
+        std::vector<llvm::StringRef> Names;
+        for (auto &D : FunctionDefs)
+            Names.push_back(getSymbolName(D.first));
+        ExitOnErr(TheJIT->materialize(Names));
+        return runServer(ServeSocket);
+    }
+
+    if (CompileOnly)
+        ExitOnErr(EmitObjectFile());
+    stopReoptimizer();
+    if (!ProfileOut.empty())
+        ExitOnErr(writeProfile(ProfileOut));
+
+    if (TheStats) {
+        recordMemoStats();
+        recordSpecializationStats();
+        TheStats->print(llvm::outs());
+    }
+
     return 0;
 
 }
\ No newline at end of file
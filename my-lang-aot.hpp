@@ -0,0 +1,156 @@
+#include<bits/stdc++.h>
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+
+
+//===----------------------------------------------------------------------===//
+// Ahead-of-time compilation
+//===----------------------------------------------------------------------===//
+
+typedef llvm::SmallVector<char, 0> ObjectImage;
+
+/// TargetCPU, TargetAttrs - -mcpu and -mattr: the processor to generate code
+/// for, "native" meaning the one we are running on with every feature it
+/// has, and features to turn on or off on top of that ("+avx2,-fma"). Both
+/// the JIT and the AOT compiler honour them, so objects can be built for
+/// older machines than the one compiling them. -mcpu=help lists the CPUs
+/// and features the target knows.
+static std::string TargetCPU = "native";
+static std::string TargetAttrs;
+
+/// getTargetCPU - TargetCPU with "native" resolved.
+static std::string getTargetCPU() {
+    return TargetCPU == "native" ? llvm::sys::getHostCPUName().str() : TargetCPU;
+}
+
+/// getTargetFeatures - The features of getTargetCPU(): for the host CPU the
+/// ones it was detected to have, otherwise the CPU's defaults; either way
+/// followed by TargetAttrs, which win.
+static llvm::SubtargetFeatures getTargetFeatures() {
+    llvm::SubtargetFeatures Features;
+    llvm::StringMap<bool> HostFeatures;
+    if (TargetCPU == "native" && llvm::sys::getHostCPUFeatures(HostFeatures))
+        for (auto &F : HostFeatures)
+            Features.AddFeature(F.getKey(), F.getValue());
+    llvm::SmallVector<llvm::StringRef, 8> Attrs;
+    llvm::StringRef(TargetAttrs).split(Attrs, ',', -1, /*KeepEmpty=*/false);
+    for (llvm::StringRef A : Attrs)
+        Features.AddFeature(A.trim());
+    return Features;
+}
+
+/// checkTargetCPU - Reject a TargetCPU the target does not know, which LLVM
+/// would otherwise warn about and ignore for every TargetMachine created.
+/// For "help", LLVM prints the CPUs and features it knows.
+static llvm::Error checkTargetCPU() {
+    if (TargetCPU == "native")
+        return llvm::Error::success();
+    std::string TargetTriple = llvm::sys::getDefaultTargetTriple();
+    std::string Error;
+    auto *Target = llvm::TargetRegistry::lookupTarget(TargetTriple, Error);
+    if (!Target)
+        return llvm::createStringError(llvm::inconvertibleErrorCode(), Error);
+    if (TargetCPU == "help") {
+        std::unique_ptr<llvm::MCSubtargetInfo>(
+            Target->createMCSubtargetInfo(TargetTriple, "help", ""));
+        return llvm::Error::success();
+    }
+    std::unique_ptr<llvm::MCSubtargetInfo> STI(
+        Target->createMCSubtargetInfo(TargetTriple, "", ""));
+    if (!STI->isCPUStringValid(TargetCPU))
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "unknown CPU '%s' (-mcpu=help lists them)",
+                                       TargetCPU.c_str());
+    return llvm::Error::success();
+}
+
+/// createHostTargetMachine - A TargetMachine for the machine we are running
+/// on, or for TargetCPU/TargetAttrs if they say otherwise. Code is position
+/// independent so that objects can also go into shared libraries.
+static llvm::Expected<std::unique_ptr<llvm::TargetMachine>>
+createHostTargetMachine(llvm::CodeGenOpt::Level OptLevel = llvm::CodeGenOpt::Default,
+                        const llvm::TargetOptions &Opt = llvm::TargetOptions()) {
+    std::string TargetTriple = llvm::sys::getDefaultTargetTriple();
+
+    std::string Error;
+    auto *Target = llvm::TargetRegistry::lookupTarget(TargetTriple, Error);
+    if (!Target)
+        return llvm::createStringError(llvm::inconvertibleErrorCode(), Error);
+
+    return std::unique_ptr<llvm::TargetMachine>(Target->createTargetMachine(
+        TargetTriple, getTargetCPU(), getTargetFeatures().getString(), Opt,
+        llvm::Reloc::PIC_, llvm::None, OptLevel));
+}
+
+/// emitObject - Run machine code generation for M and append the object file
+/// to Obj. TM must not be in use on another thread.
+static llvm::Error emitObject(llvm::TargetMachine &TM, llvm::Module &M, ObjectImage &Obj) {
+    llvm::raw_svector_ostream OS(Obj);
+    llvm::legacy::PassManager PM;
+    if (TM.addPassesToEmitFile(PM, OS, nullptr, llvm::CGFT_ObjectFile))
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "target cannot emit object files");
+    PM.run(M);
+    return llvm::Error::success();
+}
+
+static llvm::Error writeFile(llvm::StringRef Path, llvm::ArrayRef<char> Data) {
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(Path, EC, llvm::sys::fs::OF_None);
+    if (EC)
+        return llvm::createFileError(Path, EC);
+    OS.write(Data.data(), Data.size());
+    return llvm::Error::success();
+}
+
+/// linkObjects - Combine Objs into Output with the system toolchain: a
+/// relocatable object (ld -r), or a shared library (cc -shared) when Output
+/// ends in ".so". A single object bound for a ".o" is written as is.
+static llvm::Error linkObjects(llvm::ArrayRef<ObjectImage> Objs, llvm::StringRef Output) {
+    bool Shared = Output.endswith(".so");
+    if (Objs.size() == 1 && !Shared)
+        return writeFile(Output, Objs.front());
+
+    std::vector<std::string> Temps;
+    auto Cleanup = llvm::make_scope_exit([&] {
+        for (auto &T : Temps)
+            llvm::sys::fs::remove(T);
+    });
+    for (auto &Obj : Objs) {
+        llvm::SmallString<128> Path;
+        if (auto EC = llvm::sys::fs::createTemporaryFile("kaleidoscope", "o", Path))
+            return llvm::createFileError(Path, EC);
+        Temps.push_back(Path.str().str());
+        if (auto Err = writeFile(Path, Obj))
+            return Err;
+    }
+
+    const char *Tool = Shared ? "cc" : "ld";
+    auto Program = llvm::sys::findProgramByName(Tool);
+    if (!Program)
+        return llvm::createStringError(Program.getError(), "cannot find '%s'", Tool);
+
+    std::vector<llvm::StringRef> Args = {*Program, Shared ? "-shared" : "-r",
+                                         "-o", Output};
+    Args.insert(Args.end(), Temps.begin(), Temps.end());
+    std::string ErrMsg;
+    if (llvm::sys::ExecuteAndWait(*Program, Args, llvm::None, {}, 0, 0, &ErrMsg) != 0)
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "%s failed%s%s", Tool, ErrMsg.empty() ? "" : ": ",
+                                       ErrMsg.c_str());
+    return llvm::Error::success();
+}
@@ -0,0 +1,157 @@
+#include<bits/stdc++.h>
+#include "my-lang-codegen.hpp"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Twine.h"
+
+
+//===----------------------------------------------------------------------===//
+// Batch evaluation
+//===----------------------------------------------------------------------===//
+
+/// BatchFn - The batch entry point of a definition f of Arity arguments:
+///   for (I = 0; I < N; ++I) Out[I] = f(Cols[0][I], ..., Cols[Arity-1][I]);
+/// Out must not overlap any of the columns.
+typedef void (*BatchFn)(const double *const *Cols, double *Out, uint64_t N);
+
+/// BatchFunction - C++ handle to a compiled batch entry point.
+class BatchFunction {
+    BatchFn Fn = nullptr;
+    unsigned Arity = 0;
+
+    public:
+        BatchFunction() = default;
+        BatchFunction(BatchFn Fn, unsigned Arity) : Fn(Fn), Arity(Arity) {}
+
+        unsigned getArity() const { return Arity; }
+
+        /// Evaluate N rows: Columns holds one array of N values per argument,
+        /// Out receives the N results.
+        void operator()(llvm::ArrayRef<const double *> Columns, double *Out, size_t N) const {
+            assert(Columns.size() == Arity && "one column per argument");
+            Fn(Columns.data(), Out, N);
+        }
+};
+
+/// collectDefinedCallees - Add to Callees every function with a definition in
+/// FunctionDefs that E calls.
+static void collectDefinedCallees(const ExprAST *E, llvm::SmallVectorImpl<Symbol> &Callees) {
+    walkPostorder(E, [&](const ExprAST *N) {
+        if (auto *C = llvm::dyn_cast<CallExprAST>(N))
+            if (FunctionDefs.count(C->getCallee()))
+                Callees.push_back(C->getCallee());
+        return true;
+    });
+}
+
+/// emitBatchFunction - Define Name's batch entry point, "Name.batch", in
+/// TheModule. The loop calls Name row by row; Name and every definition it
+/// reaches are emitted next to it as internal copies, so the optimizer can
+/// inline the whole computation into the loop and vectorize it to the
+/// target's vector width. Only calls to externs remain calls.
+static llvm::Function *emitBatchFunction(Symbol Name) {
+    // Copy the reachable definitions in, callers first.
+    llvm::SmallVector<Symbol, 8> Worklist = {Name};
+    llvm::DenseSet<Symbol> Emitted;
+    while (!Worklist.empty()) {
+        Symbol S = Worklist.pop_back_val();
+        if (!Emitted.insert(S).second)
+            continue;
+        FunctionAST &Def = *FunctionDefs[S];
+        llvm::Function *F = Def.codegen();
+        if (!F)
+            return nullptr;
+        F->setLinkage(llvm::Function::InternalLinkage);
+        collectDefinedCallees(Def.getBody(), Worklist);
+    }
+
+    llvm::Function *Scalar = ModuleFunctions.lookup(Name);
+    unsigned Arity = Scalar->arg_size();
+    llvm::Type *DoubleTy = Builder->getDoubleTy();
+    llvm::Type *PtrTy = DoubleTy->getPointerTo();
+    llvm::Type *IntTy = Builder->getInt64Ty();
+    auto *FT = llvm::FunctionType::get(Builder->getVoidTy(),
+                                       {PtrTy->getPointerTo(), PtrTy, IntTy}, false);
+    llvm::Function *F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage,
+                                               getSymbolName(Name) + ".batch", TheModule.get());
+    setFPAttributes(*F);
+    llvm::Argument *Cols = F->getArg(0), *Out = F->getArg(1), *N = F->getArg(2);
+    Cols->setName("cols");
+    Out->setName("out");
+    N->setName("n");
+    // Out overlaps nothing else the loop touches, which is what lets it be
+    // vectorized without runtime overlap checks.
+    F->addParamAttr(0, llvm::Attribute::ReadOnly);
+    F->addParamAttr(1, llvm::Attribute::NoAlias);
+
+    auto *Entry = llvm::BasicBlock::Create(*TheContext, "entry", F);
+    auto *Loop = llvm::BasicBlock::Create(*TheContext, "loop", F);
+    auto *Exit = llvm::BasicBlock::Create(*TheContext, "exit", F);
+
+    Builder->SetInsertPoint(Entry);
+    llvm::SmallVector<llvm::Value *, 4> ColPtrs;
+    for (unsigned K = 0; K != Arity; ++K)
+        ColPtrs.push_back(Builder->CreateLoad(
+            PtrTy, Builder->CreateConstInBoundsGEP1_64(PtrTy, Cols, K), "col"));
+    Builder->CreateCondBr(Builder->CreateICmpEQ(N, Builder->getInt64(0)), Exit, Loop);
+
+    Builder->SetInsertPoint(Loop);
+    llvm::PHINode *I = Builder->CreatePHI(IntTy, 2, "i");
+    I->addIncoming(Builder->getInt64(0), Entry);
+    llvm::SmallVector<llvm::Value *, 4> Args;
+    for (llvm::Value *Col : ColPtrs)
+        Args.push_back(Builder->CreateLoad(
+            DoubleTy, Builder->CreateInBoundsGEP(DoubleTy, Col, I), "arg"));
+    llvm::Value *R = Builder->CreateCall(Scalar, Args, "r");
+    Builder->CreateStore(R, Builder->CreateInBoundsGEP(DoubleTy, Out, I));
+    llvm::Value *Next = Builder->CreateNUWAdd(I, Builder->getInt64(1), "i.next");
+    I->addIncoming(Next, Loop);
+    Builder->CreateCondBr(Builder->CreateICmpULT(Next, N), Loop, Exit);
+
+    Builder->SetInsertPoint(Exit);
+    Builder->CreateRetVoid();
+
+    llvm::verifyFunction(*F);
+    return F;
+}
+
+/// BatchFunctions - Batch entry points compiled so far.
+static llvm::DenseMap<Symbol, BatchFunction> BatchFunctions;
+
+/// getBatchFunction - The batch entry point of the definition Name, compiled
+/// by the JIT on first request.
+static llvm::Expected<BatchFunction> getBatchFunction(llvm::StringRef Name) {
+    Symbol S = internSymbol(Name);
+    auto It = BatchFunctions.find(S);
+    if (It != BatchFunctions.end())
+        return It->second;
+    if (!FunctionDefs.count(S))
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "no definition named '%s'", Name.str().c_str());
+
+    // Build the entry point in a module of its own, leaving whatever the
+    // driver has open as it was.
+    unsigned Arity = FunctionDefs[S]->getProto().getArgs().size();
+    llvm::Function *F;
+    llvm::Error Err = llvm::Error::success();
+    {
+        ModuleScope Scope;
+        F = emitBatchFunction(S);
+        if (F)
+            Err = TheJIT->addModule(Scope.take(F->getName()));
+    }
+
+    if (!F)
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "cannot generate a batch entry point for '%s'",
+                                       Name.str().c_str());
+    if (Err)
+        return Err;
+
+    auto Sym = TheJIT->lookup((Name + ".batch").str());
+    if (!Sym)
+        return Sym.takeError();
+    BatchFunction BF((BatchFn)(intptr_t)Sym->getAddress(), Arity);
+    BatchFunctions[S] = BF;
+    return BF;
+}
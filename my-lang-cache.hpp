@@ -0,0 +1,233 @@
+#include<bits/stdc++.h>
+#include "my-lang-codegen.hpp"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+
+
+//===----------------------------------------------------------------------===//
+// Compiled function cache
+//===----------------------------------------------------------------------===//
+
+/// FunctionHasher - Hashes a definition in normalized form: arguments and
+/// locals by position in scope instead of by name, and callees by name and
+/// arity, which is all that a call compiles against. Definitions that hash
+/// the same compile to the same object for the same target and options.
+class FunctionHasher {
+    llvm::SHA1 Hasher;
+    const PrototypeAST &Proto;
+    /// The arguments, then the locals in scope, innermost last.
+    std::vector<Symbol> Scope;
+
+    void addInt(uint64_t V) {
+        Hasher.update(llvm::ArrayRef<uint8_t>((const uint8_t *)&V, sizeof(V)));
+    }
+
+    void addString(llvm::StringRef S) {
+        addInt(S.size());
+        Hasher.update(S);
+    }
+
+    /// addName - Hash a reference to the variable Name. A repeated name
+    /// means the last one bound, as in codegen.
+    void addName(Symbol Name) {
+        auto It = std::find(Scope.rbegin(), Scope.rend(), Name);
+        if (It == Scope.rend())
+            addString(getSymbolName(Name));
+        else
+            addInt(Scope.rend() - It - 1);
+    }
+
+    /// enter - Bring the locals E binds into scope before its I-th operand.
+    void enter(const ExprAST *E, unsigned I) {
+        if (auto *For = llvm::dyn_cast<ForExprAST>(E)) {
+            if (I == 1)
+                Scope.push_back(For->getVar());
+        } else if (auto *Var = llvm::dyn_cast<VarExprAST>(E)) {
+            if (I != 0)
+                Scope.push_back(Var->getNames()[I - 1]);
+        }
+    }
+
+    /// addNode - Hash E itself; its operands are hashed before it, so the
+    /// encoding is a postorder one. False if E calls a function we know
+    /// nothing about, in which case it cannot compile and there is nothing
+    /// to cache.
+    bool addNode(const ExprAST *E) {
+        addInt(E->getKind());
+        switch (E->getKind()) {
+            case ExprAST::EK_Number: {
+                double Val = llvm::cast<NumberExprAST>(E)->getVal();
+                uint64_t Bits;
+                memcpy(&Bits, &Val, sizeof(Bits));
+                addInt(Bits);
+                return true;
+            }
+            case ExprAST::EK_Variable:
+                addName(llvm::cast<VariableExprAST>(E)->getName());
+                return true;
+            case ExprAST::EK_Binary:
+                addInt(llvm::cast<BinaryExprAST>(E)->getOp());
+                return true;
+            case ExprAST::EK_Call: {
+                auto *C = llvm::cast<CallExprAST>(E);
+                size_t Arity;
+                if (C->getCallee() == Proto.getSymbol())
+                    Arity = Proto.getArgs().size();
+                else {
+                    auto FI = FunctionProtos.find(C->getCallee());
+                    if (FI == FunctionProtos.end())
+                        return false;
+                    Arity = FI->second->getArgs().size();
+                }
+                addString(getSymbolName(C->getCallee()));
+                addInt(Arity);
+                // Calls to known externs may compile to intrinsics.
+                addInt(Externs.count(C->getCallee()));
+                addInt(C->getArgs().size());
+                return true;
+            }
+            case ExprAST::EK_If:
+            case ExprAST::EK_While:
+                return true;
+            case ExprAST::EK_For:
+                Scope.pop_back();
+                return true;
+            case ExprAST::EK_Var: {
+                size_t N = llvm::cast<VarExprAST>(E)->getNames().size();
+                addInt(N);
+                Scope.resize(Scope.size() - N);
+                return true;
+            }
+            case ExprAST::EK_Assign:
+                addName(llvm::cast<AssignExprAST>(E)->getName());
+                return true;
+        }
+        llvm_unreachable("unknown expression kind");
+    }
+
+    public:
+        FunctionHasher(const PrototypeAST &Proto) : Proto(Proto), Scope(Proto.getArgs()) {}
+
+        /// hash - Hex digest of Salt and the definition, or "" if it cannot
+        /// be cached.
+        std::string hash(llvm::StringRef Salt, const FunctionAST &F) {
+            addString(Salt);
+            addString(Proto.getName());
+            addInt(Proto.getArgs().size());
+            if (!walkPostorder(
+                    F.getBody(), [this](const ExprAST *E) { return addNode(E); },
+                    [](const ExprAST *) { return true; },
+                    [this](const ExprAST *E, unsigned I) {
+                        enter(E, I);
+                        return true;
+                    }))
+                return "";
+            return llvm::toHex(Hasher.final(), /*LowerCase=*/true);
+        }
+};
+
+/// FunctionCache - Objects for definitions compiled by earlier runs, one file
+/// per definition in Dir, named after the hash of the definition together
+/// with everything else that went into compiling it (see setConfiguration).
+/// A change to a definition, to the arity of something it calls, or to the
+/// options or target gives a new name, so stale entries are never picked up;
+/// they are left for pruneCache() to expire.
+///
+/// The driver looks a definition up before generating any IR for it. On a
+/// miss it tags the module with the key (setKey), and the JIT's compiler
+/// hands the object back through notifyObjectCompiled(), possibly on a
+/// compile thread. Entries are written to a temporary and renamed into place,
+/// so concurrent processes may share a directory.
+class FunctionCache : public llvm::ObjectCache {
+    std::string Dir;
+    std::string Salt;
+
+    static constexpr const char *KeyMetadata = "kaleidoscope.cache.key";
+
+    std::string getPath(llvm::StringRef Key) const {
+        llvm::SmallString<128> Path(Dir);
+        llvm::sys::path::append(Path, "llvmcache-" + Key);
+        return Path.str().str();
+    }
+
+    public:
+        FunctionCache(std::string Dir) : Dir(std::move(Dir)) {}
+
+        static llvm::Expected<std::unique_ptr<FunctionCache>> Create(llvm::StringRef Dir) {
+            if (auto EC = llvm::sys::fs::create_directories(Dir))
+                return llvm::createFileError(Dir, EC);
+            llvm::pruneCache(Dir, llvm::CachePruningPolicy());
+            return std::make_unique<FunctionCache>(Dir.str());
+        }
+
+        /// setConfiguration - Everything besides the definitions themselves
+        /// that the generated code depends on: target and options. It is
+        /// folded into every key, so it must be set before the first one.
+        void setConfiguration(llvm::StringRef Config) {
+            Salt = ("v3 LLVM " LLVM_VERSION_STRING " " + Config).str();
+        }
+
+        /// getKey - The key for F, or "" if F cannot be cached.
+        std::string getKey(const FunctionAST &F) const {
+            return FunctionHasher(F.getProto()).hash(Salt, F);
+        }
+
+        /// lookup - The object cached under Key, if there is a usable one.
+        std::unique_ptr<llvm::MemoryBuffer> lookup(llvm::StringRef Key) const {
+            std::string Path = getPath(Key);
+            auto Buf = llvm::MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                                   /*RequiresNullTerminator=*/false);
+            if (!Buf)
+                return nullptr;
+            auto Obj = llvm::object::ObjectFile::createObjectFile((*Buf)->getMemBufferRef());
+            if (!Obj) {
+                llvm::consumeError(Obj.takeError());
+                llvm::sys::fs::remove(Path);
+                return nullptr;
+            }
+            return std::move(*Buf);
+        }
+
+        /// setKey - Have the object M compiles to stored under Key.
+        static void setKey(llvm::Module &M, llvm::StringRef Key) {
+            auto &Ctx = M.getContext();
+            M.getOrInsertNamedMetadata(KeyMetadata)
+                ->addOperand(llvm::MDNode::get(Ctx, llvm::MDString::get(Ctx, Key)));
+        }
+
+        void notifyObjectCompiled(const llvm::Module *M, llvm::MemoryBufferRef Obj) override {
+            auto *MD = M->getNamedMetadata(KeyMetadata);
+            if (!MD || MD->getNumOperands() != 1)
+                return;
+            llvm::StringRef Key =
+                llvm::cast<llvm::MDString>(MD->getOperand(0)->getOperand(0))->getString();
+
+            llvm::SmallString<128> Model(Dir), Temp;
+            llvm::sys::path::append(Model, "tmp-%%%%%%%%");
+            int FD;
+            if (llvm::sys::fs::createUniqueFile(Model, FD, Temp))
+                return;
+            {
+                llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+                OS << Obj.getBuffer();
+            }
+            if (llvm::sys::fs::rename(Temp, getPath(Key)))
+                llvm::sys::fs::remove(Temp);
+        }
+
+        /// getObject - Lookups happen before IR generation, in the driver.
+        std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *) override {
+            return nullptr;
+        }
+};
+
+static std::unique_ptr<FunctionCache> TheCache;
@@ -0,0 +1,1037 @@
+#include<bits/stdc++.h>
+#include "my-lang-parser.hpp"
+#include "my-lang-jit.hpp"
+#include "my-lang-aot.hpp"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+
+
+//===----------------------------------------------------------------------===//
+// Code Generation
+//===----------------------------------------------------------------------===//
+
+//llvm declarations
+static std::unique_ptr<llvm::LLVMContext> TheContext;
+static std::unique_ptr<llvm::Module> TheModule;
+static std::unique_ptr<llvm::IRBuilder<>> Builder;
+static llvm::DenseMap<Symbol, llvm::Value *> NamedValues;
+
+/// FPFlags - Fast-math flags for every floating-point operation and call we
+/// emit (--fast-math, --reassoc, --fp-contract=fast). None by default, which
+/// keeps strict IEEE semantics.
+static llvm::FastMathFlags FPFlags;
+
+/// setFPAttributes - Tell the code generator about FPFlags: it reads the
+/// function's attributes, not the instructions' flags, for some of its own
+/// shortcuts.
+static void setFPAttributes(llvm::Function &F) {
+    if (FPFlags.isFast())
+        F.addFnAttr("unsafe-fp-math", "true");
+    if (FPFlags.noNaNs())
+        F.addFnAttr("no-nans-fp-math", "true");
+    if (FPFlags.noInfs())
+        F.addFnAttr("no-infs-fp-math", "true");
+    if (FPFlags.noSignedZeros())
+        F.addFnAttr("no-signed-zeros-fp-math", "true");
+    if (FPFlags.approxFunc())
+        F.addFnAttr("approx-func-fp-math", "true");
+}
+
+
+/// Externs - Functions declared with 'extern' and not defined since: they
+/// are resolved in the host process, so a known name means the libm
+/// function (see getMathIntrinsic).
+static llvm::DenseSet<Symbol> Externs;
+
+/// getMathIntrinsic - The LLVM intrinsic for the libm function Name taking
+/// Arity doubles, or not_intrinsic. Calls to an intrinsic can be constant
+/// folded, reasoned about and vectorized; the code generator still lowers
+/// the ones without an instruction to the libm call.
+static llvm::Intrinsic::ID getMathIntrinsic(llvm::StringRef Name, size_t Arity) {
+    struct MathFunction {
+        const char *Name;
+        llvm::Intrinsic::ID ID;
+        unsigned Arity;
+    };
+    static const MathFunction MathFunctions[] = {
+        {"sin", llvm::Intrinsic::sin, 1},     {"cos", llvm::Intrinsic::cos, 1},
+        {"exp", llvm::Intrinsic::exp, 1},     {"exp2", llvm::Intrinsic::exp2, 1},
+        {"log", llvm::Intrinsic::log, 1},     {"log2", llvm::Intrinsic::log2, 1},
+        {"log10", llvm::Intrinsic::log10, 1}, {"sqrt", llvm::Intrinsic::sqrt, 1},
+        {"fabs", llvm::Intrinsic::fabs, 1},   {"floor", llvm::Intrinsic::floor, 1},
+        {"ceil", llvm::Intrinsic::ceil, 1},   {"trunc", llvm::Intrinsic::trunc, 1},
+        {"round", llvm::Intrinsic::round, 1}, {"rint", llvm::Intrinsic::rint, 1},
+        {"nearbyint", llvm::Intrinsic::nearbyint, 1},
+        {"pow", llvm::Intrinsic::pow, 2},     {"copysign", llvm::Intrinsic::copysign, 2},
+        {"fmin", llvm::Intrinsic::minnum, 2}, {"fmax", llvm::Intrinsic::maxnum, 2},
+        {"fma", llvm::Intrinsic::fma, 3},
+    };
+    for (auto &F : MathFunctions)
+        if (Name == F.Name && Arity == F.Arity)
+            return F.ID;
+    return llvm::Intrinsic::not_intrinsic;
+}
+
+llvm::Value *LogErrorV(const char *Str) {
+  LogError(Str);
+  return nullptr;
+}
+
+
+//===----------------------------------------------------------------------===//
+// For Optimization Pass Manager method
+//===----------------------------------------------------------------------===//
+
+static std::unique_ptr<KaleidoscopeJIT> TheJIT;
+/// TheTargetMachine - Target that modules are compiled for when producing
+/// object code ahead of time instead of JIT'ing it.
+static std::unique_ptr<llvm::TargetMachine> TheTargetMachine;
+static llvm::DenseMap<Symbol, std::unique_ptr<PrototypeAST>> FunctionProtos;
+
+/// FunctionDefs - The AST of every definition compiled, for code that is
+/// generated from it again later (batch entry points, clones), and to
+/// reject a redefinition.
+static llvm::DenseMap<Symbol, std::unique_ptr<FunctionAST>> FunctionDefs;
+
+/// ModuleFunctions - Functions already declared or defined in TheModule, so
+/// call sites do not go through the module's by-name symbol table.
+static llvm::DenseMap<Symbol, llvm::Function *> ModuleFunctions;
+static llvm::ExitOnError ExitOnErr;
+
+// --------------------------------------------------------------------------------------------------
+//---------------------------------------------------------------------------------------------------
+
+/// getFunction - Every definition is JIT'd in a module of its own, so a callee
+/// may live in an earlier module. Look in the current module first, otherwise
+/// re-emit a declaration from the prototype we recorded for it.
+llvm::Function *getFunction(Symbol Name) {
+    if (auto *F = ModuleFunctions.lookup(Name))
+        return F;
+
+    auto FI = FunctionProtos.find(Name);
+    if (FI != FunctionProtos.end())
+        return FI->second->codegen();
+
+    return nullptr;
+}
+
+//===----------------------------------------------------------------------===//
+// Memoization
+//===----------------------------------------------------------------------===//
+
+/// MemoizeInferred - --memoize: memoize every pure definition that calls a
+/// definition (itself included). One that only does arithmetic on its
+/// arguments costs about as much as a cache lookup. MemoizeNames -
+/// --memoize=F,G: memoize these definitions, provided they are pure.
+static bool MemoizeInferred = false;
+static llvm::DenseSet<Symbol> MemoizeNames;
+
+/// PureFunctions - Definitions whose result depends on nothing but their
+/// arguments: they call only themselves, other pure definitions and the
+/// libm externs of getMathIntrinsic. Any other extern may have side effects.
+static llvm::DenseSet<Symbol> PureFunctions;
+
+/// MemoTableBits - A memoized function caches the results of its last calls
+/// in a table of 2^MemoTableBits entries.
+static constexpr unsigned MemoTableBits = 12;
+
+/// MemoTable - The result cache of one memoized function, written by its
+/// JIT'd wrapper: Data[0] and Data[1] count hits and misses, then come the
+/// entries, each {valid, argument bits..., result bits}. It is direct
+/// mapped: an entry is found by hashing the arguments, and a miss replaces
+/// whatever was there, so it never grows.
+struct MemoTable {
+    unsigned Arity;
+    std::unique_ptr<uint64_t[]> Data;
+
+    explicit MemoTable(unsigned Arity)
+        : Arity(Arity), Data(new uint64_t[2 + (Arity + 2) * (size_t(1) << MemoTableBits)]()) {}
+
+    uint64_t getHits() const { return Data[0]; }
+    uint64_t getMisses() const { return Data[1]; }
+};
+
+/// MemoTables - The tables of the memoized functions, by name.
+static llvm::DenseMap<Symbol, std::unique_ptr<MemoTable>> MemoTables;
+
+/// findImpureCallee - A function FnAST calls that is not known to be pure,
+/// or None if FnAST is pure.
+static llvm::Optional<Symbol> findImpureCallee(const FunctionAST &FnAST) {
+    Symbol Self = FnAST.getProto().getSymbol();
+    llvm::Optional<Symbol> Impure;
+    walkPostorder(FnAST.getBody(), [&](const ExprAST *E) {
+        auto *C = llvm::dyn_cast<CallExprAST>(E);
+        if (!C)
+            return true;
+        Symbol Callee = C->getCallee();
+        if (Callee == Self || PureFunctions.count(Callee))
+            return true;
+        if (Externs.count(Callee) &&
+            getMathIntrinsic(getSymbolName(Callee), C->getArgs().size()) !=
+                llvm::Intrinsic::not_intrinsic)
+            return true;
+        Impure = Callee;
+        return false;
+    });
+    return Impure;
+}
+
+/// planMemoization - Called for every definition before its code is
+/// generated: record whether it is pure, and give it a MemoTable if it is to
+/// be memoized (see FunctionAST::codegen).
+static void planMemoization(const FunctionAST &FnAST) {
+    Symbol S = FnAST.getProto().getSymbol();
+    // A redefinition is rejected: leave the original's table alone.
+    if (FunctionDefs.count(S))
+        return;
+    // Anything left over is from a definition that failed to compile.
+    PureFunctions.erase(S);
+    MemoTables.erase(S);
+    auto Impure = findImpureCallee(FnAST);
+    if (Impure) {
+        if (MemoizeNames.count(S))
+            fprintf(stderr, "Warning: not memoizing '%s': '%s' may have side effects\n",
+                    getSymbolName(S).str().c_str(), getSymbolName(*Impure).str().c_str());
+        return;
+    }
+    PureFunctions.insert(S);
+
+    bool CallsDefinition = false;
+    walkPostorder(FnAST.getBody(), [&](const ExprAST *E) {
+        if (auto *C = llvm::dyn_cast<CallExprAST>(E))
+            CallsDefinition |= !Externs.count(C->getCallee());
+        return !CallsDefinition;
+    });
+    if (MemoizeNames.count(S) || (MemoizeInferred && CallsDefinition))
+        MemoTables[S] = std::make_unique<MemoTable>(FnAST.getProto().getArgs().size());
+}
+
+/// emitMemoWrapper - Give F, a memoized function, a body that returns the
+/// result cached in Table for its arguments, and otherwise calls Compute
+/// (F's own body) and caches what it returns. Arguments match bit for bit,
+/// so -0.0 and 0.0 are cached apart and a NaN argument never hits.
+static void emitMemoWrapper(llvm::Function &F, llvm::Function &Compute, MemoTable &Table) {
+    llvm::Type *Int64Ty = Builder->getInt64Ty();
+    llvm::Type *DoubleTy = Builder->getDoubleTy();
+    llvm::Constant *Data = llvm::ConstantExpr::getIntToPtr(
+        Builder->getInt64(reinterpret_cast<uintptr_t>(Table.Data.get())),
+        Int64Ty->getPointerTo());
+    auto *Entry = llvm::BasicBlock::Create(*TheContext, "entry", &F);
+    auto *Hit = llvm::BasicBlock::Create(*TheContext, "hit", &F);
+    auto *Miss = llvm::BasicBlock::Create(*TheContext, "miss", &F);
+    auto Count = [&](unsigned Counter) {
+        llvm::Value *Addr = Builder->CreateConstInBoundsGEP1_64(Int64Ty, Data, Counter);
+        Builder->CreateStore(
+            Builder->CreateAdd(Builder->CreateLoad(Int64Ty, Addr), Builder->getInt64(1)), Addr);
+    };
+
+    // Multiplicative hashing: the top bits of the product depend on every
+    // bit of every argument.
+    Builder->SetInsertPoint(Entry);
+    llvm::SmallVector<llvm::Value *, 4> Args, Keys;
+    llvm::Value *Hash = Builder->getInt64(0);
+    for (llvm::Argument &A : F.args()) {
+        Args.push_back(&A);
+        Keys.push_back(Builder->CreateBitCast(&A, Int64Ty, "bits"));
+        Hash = Builder->CreateMul(Builder->CreateXor(Hash, Keys.back()),
+                                  Builder->getInt64(0x9e3779b97f4a7c15ULL), "hash");
+    }
+    llvm::Value *Slot = Builder->CreateLShr(Hash, 64 - MemoTableBits, "slot");
+    llvm::Value *Offset = Builder->CreateAdd(
+        Builder->getInt64(2), Builder->CreateMul(Slot, Builder->getInt64(Table.Arity + 2)));
+    llvm::Value *Cached = Builder->CreateInBoundsGEP(Int64Ty, Data, Offset, "cached");
+    auto Field = [&](unsigned K) { return Builder->CreateConstInBoundsGEP1_64(Int64Ty, Cached, K); };
+    llvm::Value *Found = Builder->CreateICmpNE(Builder->CreateLoad(Int64Ty, Field(0), "valid"),
+                                               Builder->getInt64(0));
+    for (unsigned K = 0; K != Keys.size(); ++K)
+        Found = Builder->CreateAnd(
+            Found, Builder->CreateICmpEQ(Builder->CreateLoad(Int64Ty, Field(1 + K)), Keys[K]));
+    Builder->CreateCondBr(Found, Hit, Miss);
+
+    Builder->SetInsertPoint(Hit);
+    Count(0);
+    Builder->CreateRet(Builder->CreateBitCast(
+        Builder->CreateLoad(Int64Ty, Field(1 + Keys.size())), DoubleTy, "result"));
+
+    Builder->SetInsertPoint(Miss);
+    llvm::Value *Result = Builder->CreateCall(&Compute, Args, "result");
+    Builder->CreateStore(Builder->getInt64(1), Field(0));
+    for (unsigned K = 0; K != Keys.size(); ++K)
+        Builder->CreateStore(Keys[K], Field(1 + K));
+    Builder->CreateStore(Builder->CreateBitCast(Result, Int64Ty), Field(1 + Keys.size()));
+    Count(1);
+    Builder->CreateRet(Result);
+}
+
+/// recordMemoStats - Add the hits and misses of every memoized function to
+/// --stats.
+static void recordMemoStats() {
+    for (auto &T : MemoTables)
+        TheStats->update(getSymbolName(T.first), [&](ItemStats &S) {
+            S.MemoHits += T.second->getHits();
+            S.MemoMisses += T.second->getMisses();
+        });
+}
+
+/// createEntryBlockAlloca - A stack slot for the local Name of F, in its
+/// entry block, where mem2reg (SROA) turns it into SSA registers.
+static llvm::AllocaInst *createEntryBlockAlloca(llvm::Function &F, Symbol Name) {
+    llvm::IRBuilder<> B(&F.getEntryBlock(), F.getEntryBlock().begin());
+    return B.CreateAlloca(B.getDoubleTy(), nullptr, getSymbolName(Name));
+}
+
+/// emitBody - Give F the body of Def, with ArgValues for Def's arguments:
+/// F's own, or constants where F is a clone (see getSpecialization).
+/// Arguments the body assigns to get a stack slot, like any other local.
+/// False if the body has an error.
+static bool emitBody(llvm::Function &F, const FunctionAST &Def,
+                     llvm::ArrayRef<llvm::Value *> ArgValues) {
+    Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", &F));
+
+    llvm::DenseSet<Symbol> Assigned;
+    llvm::DenseSet<const ExprAST *> Seen;
+    walkPostorder(
+        Def.getBody(),
+        [&](const ExprAST *E) {
+            if (auto *A = llvm::dyn_cast<AssignExprAST>(E))
+                Assigned.insert(A->getName());
+            return true;
+        },
+        [&](const ExprAST *E) { return Seen.insert(E).second; });
+    NamedValues.clear();
+    for (unsigned I = 0; I != ArgValues.size(); ++I) {
+        Symbol Name = Def.getProto().getArgs()[I];
+        if (!Assigned.count(Name)) {
+            NamedValues[Name] = ArgValues[I];
+            continue;
+        }
+        llvm::AllocaInst *Slot = createEntryBlockAlloca(F, Name);
+        Builder->CreateStore(ArgValues[I], Slot);
+        NamedValues[Name] = Slot;
+    }
+
+    llvm::Value *RetVal = Def.getBody()->codegen();
+    if (!RetVal)
+        return false;
+    Builder->CreateRet(RetVal);
+    return true;
+}
+
+//===----------------------------------------------------------------------===//
+// Specialization
+//===----------------------------------------------------------------------===//
+
+/// MaxSpecializations - --specialize[=N]: a call that passes constants to a
+/// definition calls a clone of it with the constants folded in, for up to N
+/// distinct sets of constants per definition (4 by default). Calls with any
+/// other set go to the definition itself. 0, without the option, turns
+/// specialization off.
+static unsigned MaxSpecializations = 0;
+
+/// ConstantArgs - The arguments a clone is specialized for: the bits of each
+/// constant argument, None for those it still takes at run time.
+typedef llvm::SmallVector<llvm::Optional<uint64_t>, 4> ConstantArgs;
+
+/// Specializations - The argument sets each definition has been specialized
+/// for, in the order calls first passed them. The K-th is "Name.spec.K": an
+/// internal function in every module that calls it, so no module depends on
+/// another's clones.
+static llvm::DenseMap<Symbol, std::vector<ConstantArgs>> Specializations;
+
+/// PendingSpecialization - A clone declared in TheModule, whose body is
+/// emitted from Def once the function calling it is done (see
+/// emitSpecializations).
+struct PendingSpecialization {
+    Symbol Name;
+    llvm::Function *F;
+    const FunctionAST *Def;
+    ConstantArgs Args;
+};
+static std::vector<PendingSpecialization> PendingSpecializations;
+
+/// getSpecialization - The clone of Callee to call instead of Callee with
+/// ArgsV, which takes only the arguments of ArgsV that are not constants.
+/// Null if none is, if Callee has no definition to clone, if it is memoized
+/// (its cache is the point), or if it has run out of clones. Top-level
+/// expressions run once: a clone would not pay for itself, and would take
+/// the place of one for a definition's calls.
+static llvm::Function *getSpecialization(Symbol Callee, llvm::ArrayRef<llvm::Value *> ArgsV) {
+    if (!MaxSpecializations ||
+        Builder->GetInsertBlock()->getParent()->getName().startswith("__anon_expr"))
+        return nullptr;
+    auto Def = FunctionDefs.find(Callee);
+    if (Def == FunctionDefs.end() || MemoTables.count(Callee))
+        return nullptr;
+
+    ConstantArgs Args;
+    unsigned NumConstants = 0;
+    for (llvm::Value *V : ArgsV) {
+        auto *C = llvm::dyn_cast<llvm::ConstantFP>(V);
+        Args.push_back(C ? llvm::Optional<uint64_t>(
+                               C->getValueAPF().bitcastToAPInt().getZExtValue())
+                         : llvm::None);
+        NumConstants += C != nullptr;
+    }
+    if (!NumConstants)
+        return nullptr;
+
+    auto &Known = Specializations[Callee];
+    size_t K = std::find(Known.begin(), Known.end(), Args) - Known.begin();
+    if (K == Known.size()) {
+        if (Known.size() >= MaxSpecializations)
+            return nullptr;
+        Known.push_back(Args);
+    }
+    Symbol Name = internSymbol((getSymbolName(Callee) + ".spec." + llvm::Twine(K)).str());
+    if (auto *F = ModuleFunctions.lookup(Name))
+        return F;
+
+    llvm::Type *DoubleTy = Builder->getDoubleTy();
+    auto *FT = llvm::FunctionType::get(
+        DoubleTy, std::vector<llvm::Type *>(ArgsV.size() - NumConstants, DoubleTy), false);
+    auto *F = llvm::Function::Create(FT, llvm::Function::InternalLinkage, getSymbolName(Name),
+                                     TheModule.get());
+    setFPAttributes(*F);
+    auto FArg = F->arg_begin();
+    for (unsigned I = 0; I != Args.size(); ++I)
+        if (!Args[I])
+            (FArg++)->setName(getSymbolName(Def->second->getProto().getArgs()[I]));
+    ModuleFunctions[Name] = F;
+    PendingSpecializations.push_back({Name, F, Def->second.get(), std::move(Args)});
+    return F;
+}
+
+/// emitSpecializations - Emit the bodies of the clones declared so far, and
+/// of those their bodies call in turn: the constants passed in often make
+/// more calls constant. A body with an error (a callee has gone since the
+/// definition compiled) is replaced by a call to the definition itself.
+static void emitSpecializations() {
+    while (!PendingSpecializations.empty()) {
+        PendingSpecialization P = std::move(PendingSpecializations.back());
+        PendingSpecializations.pop_back();
+        llvm::SmallVector<llvm::Value *, 4> ArgValues;
+        auto FArg = P.F->arg_begin();
+        for (auto &Bits : P.Args)
+            ArgValues.push_back(
+                Bits ? llvm::ConstantFP::get(*TheContext,
+                                             llvm::APFloat(llvm::APFloat::IEEEdouble(),
+                                                           llvm::APInt(64, *Bits)))
+                     : static_cast<llvm::Value *>(&*FArg++));
+        if (!emitBody(*P.F, *P.Def, ArgValues)) {
+            P.F->deleteBody();
+            P.F->setLinkage(llvm::Function::InternalLinkage);
+            Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", P.F));
+            Builder->CreateRet(Builder->CreateCall(getFunction(P.Def->getProto().getSymbol()),
+                                                   ArgValues, "calltmp"));
+        }
+        llvm::verifyFunction(*P.F);
+    }
+}
+
+/// dropSpecializations - Remove the clones declared for a function whose
+/// body had an error, and which nothing calls now that it is gone.
+static void dropSpecializations() {
+    for (auto &P : PendingSpecializations) {
+        ModuleFunctions.erase(P.Name);
+        P.F->eraseFromParent();
+    }
+    PendingSpecializations.clear();
+}
+
+/// mayCallSpecialization - Whether FnAST passes a constant to a definition,
+/// so that its code may take in a clone of the callee as defined in this
+/// run, which a --cache-dir key for FnAST does not cover.
+static bool mayCallSpecialization(const FunctionAST &FnAST) {
+    if (!MaxSpecializations)
+        return false;
+    // Subtrees folded to a constant by the time they are emitted.
+    llvm::DenseMap<const ExprAST *, bool> IsConstant;
+    return !walkPostorder(
+        FnAST.getBody(),
+        [&](const ExprAST *E) {
+            if (auto *C = llvm::dyn_cast<CallExprAST>(E))
+                if (FunctionDefs.count(C->getCallee()))
+                    for (unsigned I = 0; I != E->getNumChildren(); ++I)
+                        if (IsConstant.lookup(E->getChild(I)))
+                            return false;
+            IsConstant[E] = llvm::isa<NumberExprAST>(E) ||
+                            (llvm::isa<BinaryExprAST>(E) && IsConstant.lookup(E->getChild(0)) &&
+                             IsConstant.lookup(E->getChild(1)));
+            return true;
+        },
+        [&](const ExprAST *E) { return !IsConstant.count(E); });
+}
+
+/// recordSpecializationStats - Add the number of clones of every definition
+/// to --stats.
+static void recordSpecializationStats() {
+    for (auto &S : Specializations)
+        TheStats->update(getSymbolName(S.first),
+                         [&](ItemStats &Item) { Item.Specializations += S.second.size(); });
+}
+
+/// codegen - Emit the expression in postorder, each node from the values of
+/// its operands, which wait on an explicit stack: deeply nested expressions
+/// cost no native stack. A subtree shared by several parents (see
+/// ExprBuilder) is emitted the first time it is reached and reused after,
+/// until a branch, a loop, a new scope or an assignment: the value may not
+/// dominate what comes next, or no longer be current.
+///
+/// Branches and loops emit their blocks between their children, as the walk
+/// enters each, and pop the operand values they are done with as they go.
+/// Locals (var, for, and arguments the body assigns to) are stack slots in
+/// NamedValues, read with a load.
+llvm::Value *ExprAST::codegen() {
+    llvm::SmallVector<llvm::Value *, 16> Values;
+    llvm::DenseMap<const ExprAST *, llvm::Value *> Generated;
+    // The blocks of the branches and loops being emitted, innermost last.
+    struct FlowBlocks {
+        llvm::BasicBlock *Header = nullptr, *Else = nullptr, *Exit = nullptr;
+    };
+    llvm::SmallVector<FlowBlocks, 4> Flow;
+    // What the locals in scope shadow, innermost last.
+    llvm::SmallVector<std::pair<Symbol, llvm::Value *>, 4> Shadowed;
+
+    llvm::Function *TheFunction = Builder->GetInsertBlock()->getParent();
+    auto startBlock = [&](llvm::BasicBlock *BB) {
+        TheFunction->getBasicBlockList().push_back(BB);
+        Builder->SetInsertPoint(BB);
+    };
+    auto newBlock = [&](const char *Name) { return llvm::BasicBlock::Create(*TheContext, Name); };
+    auto isTrue = [&](llvm::Value *V) {
+        // NaN is not 0 either.
+        return Builder->CreateFCmpUNE(
+            V, llvm::ConstantFP::get(*TheContext, llvm::APFloat(0.0)), "cond");
+    };
+    auto bind = [&](Symbol Name, llvm::Value *Init) {
+        llvm::AllocaInst *Slot = createEntryBlockAlloca(*TheFunction, Name);
+        Builder->CreateStore(Init, Slot);
+        Shadowed.push_back({Name, NamedValues.lookup(Name)});
+        NamedValues[Name] = Slot;
+    };
+    auto unbind = [&](size_t N) {
+        while (N--) {
+            auto S = Shadowed.pop_back_val();
+            if (S.second)
+                NamedValues[S.first] = S.second;
+            else
+                NamedValues.erase(S.first);
+        }
+    };
+
+    auto Enter = [&](const ExprAST *E, unsigned I) {
+        switch (E->getKind()) {
+            case EK_If:
+                if (I == 1) {
+                    FlowBlocks F;
+                    auto *Then = llvm::BasicBlock::Create(*TheContext, "then", TheFunction);
+                    F.Else = newBlock("else");
+                    F.Exit = newBlock("ifcont");
+                    Builder->CreateCondBr(isTrue(Values.pop_back_val()), Then, F.Else);
+                    Builder->SetInsertPoint(Then);
+                    Flow.push_back(F);
+                } else if (I == 2) {
+                    Builder->CreateBr(Flow.back().Exit);
+                    // The phi takes the then value from wherever it ended.
+                    Flow.back().Header = Builder->GetInsertBlock();
+                    startBlock(Flow.back().Else);
+                }
+                break;
+            case EK_For:
+                if (I == 1) {
+                    bind(llvm::cast<ForExprAST>(E)->getVar(), Values.pop_back_val());
+                    FlowBlocks F;
+                    F.Header = newBlock("loop.cond");
+                    Builder->CreateBr(F.Header);
+                    startBlock(F.Header);
+                    Flow.push_back(F);
+                } else if (I == 2) {
+                    auto *Body = newBlock("loop.body");
+                    Flow.back().Exit = newBlock("loop.exit");
+                    Builder->CreateCondBr(isTrue(Values.pop_back_val()), Body, Flow.back().Exit);
+                    startBlock(Body);
+                } else if (I == 3)
+                    Values.pop_back(); // The body's value.
+                break;
+            case EK_While:
+                if (I == 0) {
+                    FlowBlocks F;
+                    F.Header = newBlock("loop.cond");
+                    Builder->CreateBr(F.Header);
+                    startBlock(F.Header);
+                    Flow.push_back(F);
+                } else {
+                    auto *Body = newBlock("loop.body");
+                    Flow.back().Exit = newBlock("loop.exit");
+                    Builder->CreateCondBr(isTrue(Values.pop_back_val()), Body, Flow.back().Exit);
+                    startBlock(Body);
+                }
+                break;
+            case EK_Var:
+                if (I != 0)
+                    bind(llvm::cast<VarExprAST>(E)->getNames()[I - 1], Values.pop_back_val());
+                break;
+            default:
+                return true;
+        }
+        Generated.clear();
+        return true;
+    };
+
+    auto Visit = [&](const ExprAST *E) {
+        auto It = Generated.find(E);
+        if (It != Generated.end()) {
+            Values.push_back(It->second);
+            return true;
+        }
+        llvm::Value *V = nullptr;
+        bool Reusable = true;
+        switch (E->getKind()) {
+            case EK_Number:
+                V = llvm::cast<NumberExprAST>(E)->codegen();
+                break;
+            case EK_Variable:
+                V = llvm::cast<VariableExprAST>(E)->codegen();
+                break;
+            case EK_Binary: {
+                llvm::Value *R = Values.pop_back_val();
+                llvm::Value *L = Values.pop_back_val();
+                V = llvm::cast<BinaryExprAST>(E)->codegen(L, R);
+                break;
+            }
+            case EK_Call: {
+                size_t NumArgs = E->getNumChildren();
+                V = llvm::cast<CallExprAST>(E)->codegen(
+                    llvm::makeArrayRef(Values).take_back(NumArgs));
+                Values.resize(Values.size() - NumArgs);
+                break;
+            }
+            case EK_If: {
+                llvm::Value *ElseV = Values.pop_back_val();
+                llvm::Value *ThenV = Values.pop_back_val();
+                FlowBlocks F = Flow.pop_back_val();
+                llvm::BasicBlock *ElseEnd = Builder->GetInsertBlock();
+                Builder->CreateBr(F.Exit);
+                startBlock(F.Exit);
+                llvm::PHINode *PN = Builder->CreatePHI(Builder->getDoubleTy(), 2, "iftmp");
+                PN->addIncoming(ThenV, F.Header);
+                PN->addIncoming(ElseV, ElseEnd);
+                V = PN;
+                Reusable = false;
+                break;
+            }
+            case EK_For: {
+                llvm::Value *StepV = Values.pop_back_val();
+                FlowBlocks F = Flow.pop_back_val();
+                auto *Slot = llvm::cast<llvm::AllocaInst>(
+                    NamedValues[llvm::cast<ForExprAST>(E)->getVar()]);
+                llvm::Value *Cur = Builder->CreateLoad(Slot->getAllocatedType(), Slot,
+                                                       Slot->getName());
+                Builder->CreateStore(Builder->CreateFAdd(Cur, StepV, "nextvar"), Slot);
+                Builder->CreateBr(F.Header);
+                startBlock(F.Exit);
+                unbind(1);
+                V = llvm::ConstantFP::get(*TheContext, llvm::APFloat(0.0));
+                Reusable = false;
+                break;
+            }
+            case EK_While: {
+                Values.pop_back(); // The body's value.
+                FlowBlocks F = Flow.pop_back_val();
+                Builder->CreateBr(F.Header);
+                startBlock(F.Exit);
+                V = llvm::ConstantFP::get(*TheContext, llvm::APFloat(0.0));
+                Reusable = false;
+                break;
+            }
+            case EK_Var:
+                V = Values.pop_back_val();
+                unbind(llvm::cast<VarExprAST>(E)->getNames().size());
+                Reusable = false;
+                break;
+            case EK_Assign: {
+                V = Values.pop_back_val();
+                auto *A = llvm::cast<AssignExprAST>(E);
+                // Every local the function assigns to has a slot.
+                auto *Slot = llvm::dyn_cast_or_null<llvm::AllocaInst>(NamedValues.lookup(A->getName()));
+                if (!Slot) {
+                    LogError("Unknown variable name.");
+                    return false;
+                }
+                Builder->CreateStore(V, Slot);
+                Reusable = false;
+                break;
+            }
+        }
+        if (!V)
+            return false;
+        Values.push_back(V);
+        if (Reusable)
+            Generated[E] = V;
+        else
+            Generated.clear();
+        return true;
+    };
+    auto Descend = [&](const ExprAST *E) { return !Generated.count(E); };
+    return walkPostorder(this, Visit, Descend, Enter) ? Values.back() : nullptr;
+}
+
+llvm::Value *NumberExprAST::codegen() const {
+    return llvm::ConstantFP::get(*TheContext, llvm::APFloat(Val));
+}
+
+llvm::Value *VariableExprAST::codegen() const {
+    //Look this variable up in the function.
+    llvm::Value *V = NamedValues.lookup(Name);
+    if(!V){
+        LogError("Unknown variable name.");
+        return nullptr;
+    }
+    // A local lives in a stack slot.
+    if (auto *Slot = llvm::dyn_cast<llvm::AllocaInst>(V))
+        return Builder->CreateLoad(Slot->getAllocatedType(), Slot, getSymbolName(Name));
+    return V;
+}
+
+
+llvm::Value *BinaryExprAST::codegen(llvm::Value *L, llvm::Value *R) const {
+    switch(Op) {
+        case '+':
+            return Builder->CreateFAdd(L,R,"addtmp");
+        case '-':
+            return Builder->CreateFSub(L,R,"subtmp");
+        case '*':
+            return Builder->CreateFMul(L,R,"multmp");
+        case '<':
+            L = Builder->CreateFCmpULT(L,R,"cmptmp");
+            //convert bool 0/1 to double 0.0 or 1.0
+            return Builder->CreateUIToFP(L, llvm::Type::getDoubleTy(*TheContext),"booltmp");
+        case ':':
+            return R;
+
+        default:
+            return LogErrorV("invlid binary operator");    
+    }
+}
+
+
+
+llvm::Value *CallExprAST::codegen(llvm::ArrayRef<llvm::Value *> ArgsV) const {
+    //Lookup the name in the global module table
+    llvm::Function *CalleeF = getFunction(Callee);
+    if(!CalleeF)
+        return LogErrorV("Unknown function referenced");
+    
+    //If argument mismatch error
+    if(CalleeF->arg_size() != ArgsV.size())
+        return LogErrorV("Incorrect # arguments passed");
+
+    if (auto *Spec = getSpecialization(Callee, ArgsV)) {
+        llvm::SmallVector<llvm::Value *, 4> Rest;
+        for (llvm::Value *V : ArgsV)
+            if (!llvm::isa<llvm::ConstantFP>(V))
+                Rest.push_back(V);
+        return Builder->CreateCall(Spec, Rest, "calltmp");
+    }
+
+    if (Externs.count(Callee)) {
+        auto ID = getMathIntrinsic(getSymbolName(Callee), ArgsV.size());
+        if (ID != llvm::Intrinsic::not_intrinsic)
+            return Builder->CreateIntrinsic(ID, {Builder->getDoubleTy()}, ArgsV, nullptr,
+                                            "calltmp");
+    }
+
+    return Builder->CreateCall(CalleeF, ArgsV, "calltmp");
+    
+}
+
+llvm::Function *PrototypeAST::codegen(){
+    //Make the function type: double(double,double) etc.
+    std::vector<llvm::Type*> Doubles (Args.size(), llvm::Type::getDoubleTy(*TheContext));
+
+    llvm::FunctionType *FT = llvm::FunctionType::get(llvm::Type::getDoubleTy(*TheContext),Doubles, false);
+
+    llvm::Function *F = llvm::Function::Create(FT,llvm::Function::ExternalLinkage, getName(),TheModule.get());
+    ModuleFunctions[Name] = F;
+    setFPAttributes(*F);
+
+    //set the names for all the arguments
+    unsigned Idx = 0;
+    for(auto &Arg : F->args())
+        Arg.setName(getSymbolName(Args[Idx++]));
+    
+    return F;
+}
+
+
+llvm::Function *FunctionAST::codegen(){
+    // A definition earlier in this module. The driver rejects those in
+    // other modules before generating any code (see HandleDefinition).
+    auto &P = *Proto;
+    llvm::Function *Existing = ModuleFunctions.lookup(P.getSymbol());
+    if (Existing && !Existing->empty())
+        return (llvm::Function*)LogErrorV("Function cannot be redefined.");
+
+    // Record a copy of the prototype in the FunctionProtos map so later
+    // modules can declare this function; the AST keeps its own.
+    FunctionProtos[P.getSymbol()] = std::make_unique<PrototypeAST>(P);
+    Externs.erase(P.getSymbol());
+
+    llvm::Function *TheFunction = getFunction(P.getSymbol());
+    if(!TheFunction)
+        return nullptr;
+
+    // A memoized function's body goes into an internal function of its own,
+    // which the function calls on a cache miss. Recursive calls still go
+    // through the cache.
+    auto Memo = MemoTables.find(P.getSymbol());
+    llvm::Function *BodyF = TheFunction;
+    if (Memo != MemoTables.end()) {
+        BodyF = llvm::Function::Create(TheFunction->getFunctionType(),
+                                       llvm::Function::InternalLinkage,
+                                       P.getName() + ".compute", TheModule.get());
+        setFPAttributes(*BodyF);
+        for (unsigned I = 0; I != BodyF->arg_size(); ++I)
+            BodyF->getArg(I)->setName(TheFunction->getArg(I)->getName());
+    }
+    
+    llvm::SmallVector<llvm::Value *, 4> Args;
+    for (auto &Arg : BodyF->args())
+        Args.push_back(&Arg);
+    if (emitBody(*BodyF, *this, Args)) {
+        //Finish off the function.
+        if (BodyF != TheFunction) {
+            emitMemoWrapper(*TheFunction, *BodyF, *Memo->second);
+            llvm::verifyFunction(*BodyF);
+        }
+
+        //Validate the generated code, checking for consistency. Optimization
+        //is left to optimizeModule(), which the JIT runs as it compiles.
+        llvm::verifyFunction(*TheFunction);
+        emitSpecializations();
+
+        return TheFunction;
+    }
+
+    //Error reading the body, remove function
+    Symbol Name = P.getSymbol();
+    ModuleFunctions.erase(Name);
+    FunctionProtos.erase(Name);
+    if (BodyF != TheFunction)
+        BodyF->eraseFromParent();
+    TheFunction->eraseFromParent();
+    dropSpecializations();
+    return nullptr;
+
+}
+
+//===----------------------------------------------------------------------===//
+// Module and pass manager setup
+//===----------------------------------------------------------------------===//
+
+static void InitializeModule() {
+  // Drop any module still open before its context goes away, then open a
+  // new context and module.
+  Builder.reset();
+  TheModule.reset();
+  TheContext = std::make_unique<llvm::LLVMContext>();
+  TheModule = std::make_unique<llvm::Module>("my cool jit", *TheContext);
+  ModuleFunctions.clear();
+  if (TheJIT) {
+    TheModule->setTargetTriple(TheJIT->getTargetTriple().str());
+    TheModule->setDataLayout(TheJIT->getDataLayout());
+  }
+  else if (TheTargetMachine) {
+    TheModule->setTargetTriple(TheTargetMachine->getTargetTriple().str());
+    TheModule->setDataLayout(TheTargetMachine->createDataLayout());
+  }
+
+  // Create a new builder for the module.
+  Builder = std::make_unique<llvm::IRBuilder<>>(*TheContext);
+  Builder->setFastMathFlags(FPFlags);
+}
+
+/// ModuleScope - For as long as it lives, code is generated into a fresh
+/// module of its own; whatever module the driver had open is restored after.
+class ModuleScope {
+  std::unique_ptr<llvm::LLVMContext> SavedContext;
+  std::unique_ptr<llvm::Module> SavedModule;
+  std::unique_ptr<llvm::IRBuilder<>> SavedBuilder;
+  llvm::DenseMap<Symbol, llvm::Function *> SavedFunctions;
+
+public:
+  ModuleScope()
+      : SavedContext(std::move(TheContext)), SavedModule(std::move(TheModule)),
+        SavedBuilder(std::move(Builder)) {
+    std::swap(SavedFunctions, ModuleFunctions);
+    InitializeModule();
+  }
+
+  ~ModuleScope() {
+    // Our module, if not handed off, goes before its context.
+    Builder = std::move(SavedBuilder);
+    TheModule = std::move(SavedModule);
+    TheContext = std::move(SavedContext);
+    std::swap(SavedFunctions, ModuleFunctions);
+  }
+
+  ModuleScope(const ModuleScope &) = delete;
+  ModuleScope &operator=(const ModuleScope &) = delete;
+
+  /// take - The module generated so far, named Name, with its context.
+  llvm::orc::ThreadSafeModule take(llvm::StringRef Name) {
+    TheModule->setModuleIdentifier(Name);
+    return llvm::orc::ThreadSafeModule(std::move(TheModule), std::move(TheContext));
+  }
+};
+
+
+/// OptLevel - The -O level: 0 skips IR optimization altogether (and asks the
+/// code generator for its fastest mode); 1-3 select the standard new pass
+/// manager pipelines.
+static unsigned OptLevel = 2;
+
+/// VecLib - --veclib: the vector math library whose SIMD variants of libm
+/// functions the vectorizers may call. VecLibName is its name as given.
+static llvm::TargetLibraryInfoImpl::VectorLibrary VecLib =
+    llvm::TargetLibraryInfoImpl::NoLibrary;
+static std::string VecLibName = "none";
+
+/// setVecLib - Select the vector library Name ("libmvec", "svml" or "none")
+/// and load it into the process, where the JIT resolves its functions.
+static llvm::Error setVecLib(llvm::StringRef Name) {
+  const char *Library = nullptr;
+  if (Name == "libmvec") {
+    VecLib = llvm::TargetLibraryInfoImpl::LIBMVEC_X86;
+    Library = "libmvec.so.1";
+  } else if (Name == "svml") {
+    VecLib = llvm::TargetLibraryInfoImpl::SVML;
+    Library = "libsvml.so";
+  } else if (Name == "none")
+    VecLib = llvm::TargetLibraryInfoImpl::NoLibrary;
+  else
+    return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                   "unknown vector library '%s'", Name.str().c_str());
+  VecLibName = Name.str();
+  std::string Err;
+  if (Library && llvm::sys::DynamicLibrary::LoadLibraryPermanently(Library, &Err))
+    return llvm::createStringError(llvm::inconvertibleErrorCode(), "%s", Err.c_str());
+  return llvm::Error::success();
+}
+
+/// getTargetOptions - Target options for FPFlags. Contraction has to be
+/// enabled here as well as on the instructions for the code generator to
+/// fuse multiplies and adds into FMAs.
+static llvm::TargetOptions getTargetOptions() {
+  llvm::TargetOptions Opts;
+  if (FPFlags.allowContract())
+    Opts.AllowFPOpFusion = llvm::FPOpFusion::Fast;
+  Opts.UnsafeFPMath = FPFlags.isFast();
+  Opts.NoNaNsFPMath = FPFlags.noNaNs();
+  Opts.NoInfsFPMath = FPFlags.noInfs();
+  Opts.NoSignedZerosFPMath = FPFlags.noSignedZeros();
+  return Opts;
+}
+
+/// getFPModeDescription - FPFlags in words, for everything keyed on how
+/// code was compiled.
+static std::string getFPModeDescription() {
+  if (!FPFlags.any())
+    return "strict-fp";
+  if (FPFlags.isFast())
+    return "fast-math";
+  std::string Desc = "fp";
+  for (auto Flag : {std::make_pair(FPFlags.allowReassoc(), " reassoc"),
+                    std::make_pair(FPFlags.noNaNs(), " nnan"),
+                    std::make_pair(FPFlags.noInfs(), " ninf"),
+                    std::make_pair(FPFlags.noSignedZeros(), " nsz"),
+                    std::make_pair(FPFlags.allowReciprocal(), " arcp"),
+                    std::make_pair(FPFlags.allowContract(), " contract"),
+                    std::make_pair(FPFlags.approxFunc(), " afn")})
+    if (Flag.first)
+      Desc += Flag.second;
+  return Desc;
+}
+
+static llvm::CodeGenOpt::Level getCodeGenOptLevel() {
+  switch (OptLevel) {
+  case 0: return llvm::CodeGenOpt::None;
+  case 1: return llvm::CodeGenOpt::Less;
+  case 2: return llvm::CodeGenOpt::Default;
+  default: return llvm::CodeGenOpt::Aggressive;
+  }
+}
+
+/// optimizeModule - Run the OptLevel pipeline over M. This is a whole-module
+/// pipeline, so besides the function passes it inlines, propagates constants
+/// interprocedurally and vectorizes loops and straight-line code across
+/// whatever functions M holds. Everything is local to the call, so modules
+/// may be optimized concurrently. TM, if given, is the target M will be
+/// compiled for; it lets the cost models see the real vector width and
+/// instruction costs, and must not be in use on another thread. With
+/// --stats, the time of the run and of each pass and the instruction counts
+/// around it are recorded against M.
+static void optimizeModule(llvm::Module &M, llvm::TargetMachine *TM = nullptr) {
+  if (!TheStats && OptLevel == 0)
+    return;
+
+  PassTimers Timers;
+  auto Start = StatsClock::now();
+  unsigned InstsBefore = TheStats ? M.getInstructionCount() : 0;
+
+  if (OptLevel != 0) {
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+
+    llvm::PassInstrumentationCallbacks PIC;
+    if (TheStats)
+      Timers.registerCallbacks(PIC);
+    llvm::PassBuilder PB(TM, llvm::PipelineTuningOptions(), llvm::None,
+                         TheStats ? &PIC : nullptr);
+    // Registered ahead of the defaults, so this is the one used.
+    llvm::TargetLibraryInfoImpl TLII(llvm::Triple(M.getTargetTriple()));
+    TLII.addVectorizableFunctionsFromVecLib(VecLib);
+    FAM.registerPass([&] { return llvm::TargetLibraryAnalysis(TLII); });
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    static const llvm::OptimizationLevel Levels[] = {
+        llvm::OptimizationLevel::O0, llvm::OptimizationLevel::O1,
+        llvm::OptimizationLevel::O2, llvm::OptimizationLevel::O3};
+    llvm::ModulePassManager MPM =
+        PB.buildPerModuleDefaultPipeline(Levels[std::min(OptLevel, 3u)]);
+    MPM.run(M, MAM);
+  }
+
+  if (!TheStats)
+    return;
+  double Seconds = secondsSince(Start);
+  unsigned InstsAfter = M.getInstructionCount();
+  TheStats->update(M.getModuleIdentifier(), [&](ItemStats &S) {
+    S.Optimize += Seconds;
+    S.InstsBefore += InstsBefore;
+    S.InstsAfter += InstsAfter;
+    for (auto &P : Timers.Passes)
+      S.Passes[P.getKey()] += P.getValue();
+  });
+}
+
+/// recordCodeGen - NotifyCompiledFn for --stats.
+static void recordCodeGen(llvm::Module &M, double Seconds, size_t ObjectBytes) {
+  TheStats->update(M.getModuleIdentifier(), [&](ItemStats &S) {
+    S.CodeGen += Seconds;
+    S.ObjectBytes += ObjectBytes;
+  });
+}
@@ -0,0 +1,530 @@
+#include<bits/stdc++.h>
+#include "my-lang-cache.hpp"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+
+
+//===----------------------------------------------------------------------===//
+// Tiered execution
+//===----------------------------------------------------------------------===//
+
+/// TierUpThreshold - Calls and loop iterations after which an interpreted
+/// function is compiled by the JIT (--tiered=N).
+static unsigned TierUpThreshold = 1000;
+
+/// NativeEntry - How the interpreter calls compiled code: "f.entry" takes f's
+/// arguments as an array.
+typedef double (*NativeEntry)(const double *Args);
+
+/// NativeLoop - A loop compiled on its own (see compileLoop): it runs from
+/// the loop's header to its exit on the interpreter's locals.
+typedef void (*NativeLoop)(double *Locals);
+
+struct TieredFunction;
+
+/// Instr - One instruction of the interpreter's stack machine. A function's
+/// code is its body in postorder: operands are pushed, operators pop theirs
+/// and push the result, and the value left on the stack is returned.
+/// Branches and loops jump over and back across their operands' code.
+/// Locals are numbered: first the arguments, then the variables of var and
+/// for, a local for every one in scope.
+struct Instr {
+    enum Opcode : uint8_t {
+        Const, Load, Store, Pop, Add, Sub, Mul, Less, Seq, Call, Jump, JumpIfZero, Loop
+    };
+
+    Opcode Op;
+    unsigned Index = 0;                 // Load, Store: the local. Jump*: the target.
+                                        // Loop: the loop, in TieredFunction::Loops.
+    double Val = 0;                     // Const: the value.
+    TieredFunction *Callee = nullptr;   // Call: pops Callee's arity arguments.
+};
+
+/// TieredLoop - A for or while loop in a function's code. Its header is a
+/// Loop instruction, which every iteration passes; Exit is where the code
+/// goes on after it, with the loop's value (0) still to push. Scope is the
+/// locals in scope at the header, by number.
+struct TieredLoop {
+    const ExprAST *Loop;
+    std::vector<Symbol> Scope;
+    size_t Header = 0, Exit = 0;
+    NativeLoop Native = nullptr;
+    bool Failed = false;
+};
+
+/// TieredFunction - A function as --tiered runs it: interpreted from Code
+/// until calls to it and iterations of its loops add up to TierUpThreshold,
+/// then through Native. A loop that gets there in the middle of a call is
+/// compiled on its own and finishes in native code (see compileLoop). An
+/// extern has no Code and is always called natively.
+struct TieredFunction {
+    Symbol Name;
+    unsigned Arity;
+    FunctionAST *Def = nullptr;
+    std::vector<Instr> Code;
+    std::vector<TieredLoop> Loops;
+    unsigned MaxStack = 0, NumLocals = 0;
+    uint64_t Calls = 0;
+    NativeEntry Native = nullptr;
+    bool PromotionFailed = false;
+};
+
+/// TieredFunctions - Every definition and extern seen under --tiered.
+static llvm::DenseMap<Symbol, std::unique_ptr<TieredFunction>> TieredFunctions;
+
+/// getTieredFunction - The function Name, null if there is no such function.
+static TieredFunction *getTieredFunction(Symbol Name) {
+    auto &F = TieredFunctions[Name];
+    if (!F) {
+        auto PI = FunctionProtos.find(Name);
+        if (PI == FunctionProtos.end()) {
+            TieredFunctions.erase(Name);
+            return nullptr;
+        }
+        F = std::make_unique<TieredFunction>();
+        F->Name = Name;
+        F->Arity = PI->second->getArgs().size();
+    }
+    return F.get();
+}
+
+/// compileExpr - Append the code for E, which runs with the arguments Args,
+/// to Code, and its loops to Loops; raise MaxStack to the most values it
+/// keeps on the stack, and NumLocals to the most locals it uses.
+static bool compileExpr(const ExprAST *E, const std::vector<Symbol> &Args,
+                        std::vector<Instr> &Code, std::vector<TieredLoop> &Loops,
+                        unsigned &MaxStack, unsigned &NumLocals) {
+    // The stack height follows the code, except that the two arms of an if
+    // each start from the height before them.
+    unsigned Depth = 0;
+    auto emit = [&](Instr::Opcode Op, int StackEffect, unsigned Index = 0) -> Instr & {
+        Code.emplace_back();
+        Code.back().Op = Op;
+        Code.back().Index = Index;
+        Depth += StackEffect;
+        MaxStack = std::max(MaxStack, Depth);
+        return Code.back();
+    };
+    // The locals in scope, innermost last: like NamedValues, the last of a
+    // name wins.
+    std::vector<Symbol> Scope(Args);
+    NumLocals = std::max<unsigned>(NumLocals, Scope.size());
+    auto lookup = [&](Symbol Name, unsigned &Local) {
+        auto It = std::find(Scope.rbegin(), Scope.rend(), Name);
+        if (It == Scope.rend()) {
+            LogError("Unknown variable name.");
+            return false;
+        }
+        Local = Scope.rend() - It - 1;
+        return true;
+    };
+    auto bind = [&](Symbol Name) {
+        emit(Instr::Store, -1, Scope.size());
+        Scope.push_back(Name);
+        NumLocals = std::max<unsigned>(NumLocals, Scope.size());
+    };
+    // Jumps whose target is not known yet, and loop headers, innermost last.
+    llvm::SmallVector<size_t, 8> Marks;
+    // The loops being compiled, innermost last.
+    llvm::SmallVector<size_t, 4> OpenLoops;
+    auto openLoop = [&](const ExprAST *N) {
+        Marks.push_back(Code.size());
+        OpenLoops.push_back(Loops.size());
+        Loops.emplace_back();
+        Loops.back().Loop = N;
+        Loops.back().Scope = Scope;
+        Loops.back().Header = Code.size();
+        emit(Instr::Loop, 0, OpenLoops.back());
+    };
+
+    auto Enter = [&](const ExprAST *N, unsigned I) {
+        switch (N->getKind()) {
+            case ExprAST::EK_If:
+                if (I == 1) {
+                    Marks.push_back(Code.size());
+                    emit(Instr::JumpIfZero, -1);
+                } else if (I == 2) {
+                    size_t Skip = Code.size();
+                    emit(Instr::Jump, 0);
+                    Code[Marks.back()].Index = Code.size();
+                    Marks.back() = Skip;
+                    Depth--; // The else arm starts without the then value.
+                }
+                break;
+            case ExprAST::EK_For:
+                if (I == 1) {
+                    bind(llvm::cast<ForExprAST>(N)->getVar());
+                    openLoop(N);
+                } else if (I == 2) {
+                    Marks.push_back(Code.size());
+                    emit(Instr::JumpIfZero, -1);
+                } else if (I == 3)
+                    emit(Instr::Pop, -1);
+                break;
+            case ExprAST::EK_While:
+                if (I == 0)
+                    openLoop(N);
+                else {
+                    Marks.push_back(Code.size());
+                    emit(Instr::JumpIfZero, -1);
+                }
+                break;
+            case ExprAST::EK_Var:
+                if (I != 0)
+                    bind(llvm::cast<VarExprAST>(N)->getNames()[I - 1]);
+                break;
+            default:
+                break;
+        }
+        return true;
+    };
+
+    // closeLoop - Jump back to the loop's header, and out of it to here.
+    auto closeLoop = [&]() {
+        size_t Exit = Marks.pop_back_val();
+        emit(Instr::Jump, 0, Marks.pop_back_val());
+        Code[Exit].Index = Code.size();
+        Loops[OpenLoops.pop_back_val()].Exit = Code.size();
+        emit(Instr::Const, 1).Val = 0;
+    };
+
+    auto Visit = [&](const ExprAST *N) {
+        switch (N->getKind()) {
+            case ExprAST::EK_Number:
+                emit(Instr::Const, 1).Val = llvm::cast<NumberExprAST>(N)->getVal();
+                break;
+            case ExprAST::EK_Variable: {
+                unsigned Local;
+                if (!lookup(llvm::cast<VariableExprAST>(N)->getName(), Local))
+                    return false;
+                emit(Instr::Load, 1, Local);
+                break;
+            }
+            case ExprAST::EK_Binary: {
+                Instr::Opcode Op;
+                switch (llvm::cast<BinaryExprAST>(N)->getOp()) {
+                    case '+': Op = Instr::Add; break;
+                    case '-': Op = Instr::Sub; break;
+                    case '*': Op = Instr::Mul; break;
+                    case '<': Op = Instr::Less; break;
+                    case ':': Op = Instr::Seq; break;
+                    default:
+                        LogError("invalid binary operator");
+                        return false;
+                }
+                emit(Op, -1);
+                break;
+            }
+            case ExprAST::EK_Call: {
+                auto *C = llvm::cast<CallExprAST>(N);
+                TieredFunction *Callee = getTieredFunction(C->getCallee());
+                if (!Callee) {
+                    LogError("Unknown function referenced");
+                    return false;
+                }
+                if (Callee->Arity != C->getArgs().size()) {
+                    LogError("Incorrect # arguments passed");
+                    return false;
+                }
+                emit(Instr::Call, 1 - (int)Callee->Arity).Callee = Callee;
+                break;
+            }
+            case ExprAST::EK_If:
+                Code[Marks.pop_back_val()].Index = Code.size();
+                break;
+            case ExprAST::EK_For: {
+                // Var += Step.
+                unsigned Local = Scope.size() - 1;
+                emit(Instr::Load, 1, Local);
+                emit(Instr::Add, -1);
+                emit(Instr::Store, -1, Local);
+                Scope.pop_back();
+                closeLoop();
+                break;
+            }
+            case ExprAST::EK_While:
+                emit(Instr::Pop, -1);
+                closeLoop();
+                break;
+            case ExprAST::EK_Var:
+                Scope.resize(Scope.size() - llvm::cast<VarExprAST>(N)->getNames().size());
+                break;
+            case ExprAST::EK_Assign: {
+                unsigned Local;
+                if (!lookup(llvm::cast<AssignExprAST>(N)->getName(), Local))
+                    return false;
+                emit(Instr::Store, -1, Local);
+                emit(Instr::Load, 1, Local);
+                break;
+            }
+        }
+        return true;
+    };
+    return walkPostorder(E, Visit, [](const ExprAST *) { return true; }, Enter);
+}
+
+/// compileFunction - Compile F's code from Def.
+static bool compileFunction(TieredFunction &F, FunctionAST &Def) {
+    F.Def = &Def;
+    F.Code.clear();
+    F.Loops.clear();
+    F.MaxStack = F.NumLocals = 0;
+    return compileExpr(Def.getBody(), Def.getProto().getArgs(), F.Code, F.Loops, F.MaxStack,
+                       F.NumLocals);
+}
+
+/// emitEntryPoint - Define Name's NativeEntry, "Name.entry", in TheModule.
+static llvm::Function *emitEntryPoint(Symbol Name) {
+    llvm::Function *Callee = getFunction(Name);
+    if (!Callee)
+        return nullptr;
+    llvm::Type *DoubleTy = Builder->getDoubleTy();
+    auto *FT = llvm::FunctionType::get(DoubleTy, {DoubleTy->getPointerTo()}, false);
+    llvm::Function *F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage,
+                                               getSymbolName(Name) + ".entry", TheModule.get());
+    setFPAttributes(*F);
+    llvm::Argument *Args = F->getArg(0);
+    Args->setName("args");
+    Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", F));
+    llvm::SmallVector<llvm::Value *, 4> ArgsV;
+    for (unsigned K = 0; K != Callee->arg_size(); ++K)
+        ArgsV.push_back(Builder->CreateLoad(
+            DoubleTy, Builder->CreateConstInBoundsGEP1_64(DoubleTy, Args, K), "arg"));
+    Builder->CreateRet(Builder->CreateCall(Callee, ArgsV, "calltmp"));
+    llvm::verifyFunction(*F);
+    return F;
+}
+
+/// promote - Compile F, and every interpreted definition it may call, with
+/// the JIT. Native code never calls back into the interpreter.
+static llvm::Error promote(TieredFunction &F) {
+    llvm::SmallVector<TieredFunction *, 8> Worklist = {&F}, Promoted;
+    llvm::DenseSet<TieredFunction *> Seen;
+    while (!Worklist.empty()) {
+        TieredFunction *T = Worklist.pop_back_val();
+        if (T->Native || !Seen.insert(T).second)
+            continue;
+        Promoted.push_back(T);
+        for (const Instr &I : T->Code)
+            if (I.Op == Instr::Call)
+                Worklist.push_back(I.Callee);
+    }
+
+    // Each function gets a module of its own, as in the other modes.
+    for (TieredFunction *T : Promoted) {
+        ModuleScope Scope;
+        if (T->Def && !T->Def->codegen())
+            return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                           "cannot generate code for '%s'",
+                                           getSymbolName(T->Name).str().c_str());
+        if (!emitEntryPoint(T->Name))
+            return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                           "cannot generate an entry point for '%s'",
+                                           getSymbolName(T->Name).str().c_str());
+        if (auto Err = TheJIT->addModule(Scope.take(getSymbolName(T->Name))))
+            return Err;
+    }
+
+    std::vector<std::string> Entries;
+    for (TieredFunction *T : Promoted)
+        Entries.push_back((getSymbolName(T->Name) + ".entry").str());
+    std::vector<llvm::StringRef> Names(Entries.begin(), Entries.end());
+    if (auto Err = TheJIT->materialize(Names))
+        return Err;
+    for (size_t K = 0; K != Promoted.size(); ++K) {
+        auto Sym = TheJIT->lookup(Entries[K]);
+        if (!Sym)
+            return Sym.takeError();
+        Promoted[K]->Native = (NativeEntry)(intptr_t)Sym->getAddress();
+    }
+    return llvm::Error::success();
+}
+
+/// compileLoop - Compile the loop L of F with the JIT, as "F.loop.N": a
+/// function that picks the loop up at its header from F's locals, runs it
+/// to its exit and stores the locals back. A for loop resumes with its
+/// variable as the interpreter left it. Everything the loop may call is
+/// promoted first.
+static llvm::Error compileLoop(TieredFunction &F, TieredLoop &L) {
+    for (size_t PC = L.Header; PC != L.Exit; ++PC)
+        if (F.Code[PC].Op == Instr::Call && !F.Code[PC].Callee->Native)
+            if (auto Err = promote(*F.Code[PC].Callee))
+                return Err;
+
+    static unsigned NumLoops = 0;
+    std::string Name = (getSymbolName(F.Name) + ".loop." + llvm::Twine(NumLoops++)).str();
+    {
+        ModuleScope Scope;
+        llvm::Type *DoubleTy = Builder->getDoubleTy();
+        auto *FT = llvm::FunctionType::get(Builder->getVoidTy(), {DoubleTy->getPointerTo()},
+                                           false);
+        llvm::Function *Fn = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, Name,
+                                                    TheModule.get());
+        setFPAttributes(*Fn);
+        llvm::Argument *Locals = Fn->getArg(0);
+        Locals->setName("locals");
+        Builder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", Fn));
+
+        // A stack slot for every local the loop can see: the last of a name.
+        NamedValues.clear();
+        llvm::SmallVector<std::pair<unsigned, llvm::AllocaInst *>, 8> Slots;
+        for (unsigned K = L.Scope.size(); K-- > 0;) {
+            Symbol Local = L.Scope[K];
+            if (NamedValues.count(Local))
+                continue;
+            llvm::AllocaInst *Slot = createEntryBlockAlloca(*Fn, Local);
+            Builder->CreateStore(
+                Builder->CreateLoad(DoubleTy,
+                                    Builder->CreateConstInBoundsGEP1_64(DoubleTy, Locals, K)),
+                Slot);
+            NamedValues[Local] = Slot;
+            Slots.push_back({K, Slot});
+        }
+
+        // The loop from its header on. Only code is generated from these
+        // nodes, so they can go with the arena.
+        ASTArena Arena;
+        ExprAST *Loop = const_cast<ExprAST *>(L.Loop);
+        if (auto *For = llvm::dyn_cast<ForExprAST>(L.Loop))
+            Loop = Arena.create<ForExprAST>(For->getVar(),
+                                            Arena.create<VariableExprAST>(For->getVar()),
+                                            const_cast<ExprAST *>(For->getEnd()),
+                                            const_cast<ExprAST *>(For->getBody()),
+                                            const_cast<ExprAST *>(For->getStep()));
+        if (!Loop->codegen()) {
+            dropSpecializations();
+            return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                           "cannot generate code for a loop in '%s'",
+                                           getSymbolName(F.Name).str().c_str());
+        }
+        for (auto &S : Slots)
+            Builder->CreateStore(
+                Builder->CreateLoad(DoubleTy, S.second),
+                Builder->CreateConstInBoundsGEP1_64(DoubleTy, Locals, S.first));
+        Builder->CreateRetVoid();
+        llvm::verifyFunction(*Fn);
+        emitSpecializations();
+        if (auto Err = TheJIT->addModule(Scope.take(Name)))
+            return Err;
+    }
+
+    llvm::StringRef Names[] = {Name};
+    if (auto Err = TheJIT->materialize(Names))
+        return Err;
+    auto Sym = TheJIT->lookup(Name);
+    if (!Sym)
+        return Sym.takeError();
+    L.Native = (NativeLoop)(intptr_t)Sym->getAddress();
+    return llvm::Error::success();
+}
+
+/// callTiered - Call F with Args, interpreting it or running its native code.
+static double callTiered(TieredFunction &F, const double *Args) {
+    if (!F.Native && !F.PromotionFailed && (!F.Def || ++F.Calls >= TierUpThreshold)) {
+        if (auto Err = promote(F)) {
+            llvm::logAllUnhandledErrors(std::move(Err), llvm::errs(), "Error: ");
+            F.PromotionFailed = true;
+        }
+    }
+    if (F.Native)
+        return F.Native(Args);
+    if (!F.Def)
+        return 0; // An extern the JIT could not resolve.
+
+    llvm::SmallVector<double, 16> Stack(F.MaxStack);
+    llvm::SmallVector<double, 8> Locals(Args, Args + F.Arity);
+    Locals.resize(F.NumLocals);
+    unsigned SP = 0;
+    for (size_t PC = 0; PC != F.Code.size();) {
+        const Instr &I = F.Code[PC++];
+        switch (I.Op) {
+            case Instr::Const: Stack[SP++] = I.Val; break;
+            case Instr::Load: Stack[SP++] = Locals[I.Index]; break;
+            case Instr::Store: Locals[I.Index] = Stack[--SP]; break;
+            case Instr::Pop: SP--; break;
+            case Instr::Add: SP--; Stack[SP-1] = Stack[SP-1] + Stack[SP]; break;
+            case Instr::Sub: SP--; Stack[SP-1] = Stack[SP-1] - Stack[SP]; break;
+            case Instr::Mul: SP--; Stack[SP-1] = Stack[SP-1] * Stack[SP]; break;
+            // Unordered or less than, as the JIT'd fcmp ult and ExprBuilder's
+            // folding: a NaN operand gives 1.
+            case Instr::Less: SP--; Stack[SP-1] = !(Stack[SP-1] >= Stack[SP]) ? 1.0 : 0.0; break;
+            case Instr::Seq: SP--; Stack[SP-1] = Stack[SP]; break;
+            case Instr::Call: {
+                SP -= I.Callee->Arity;
+                double R = callTiered(*I.Callee, &Stack[SP]);
+                Stack[SP++] = R;
+                break;
+            }
+            case Instr::Jump: PC = I.Index; break;
+            case Instr::Loop: {
+                TieredLoop &L = F.Loops[I.Index];
+                if (!L.Native && !L.Failed && ++F.Calls >= TierUpThreshold) {
+                    if (auto Err = compileLoop(F, L)) {
+                        llvm::logAllUnhandledErrors(std::move(Err), llvm::errs(), "Error: ");
+                        L.Failed = true;
+                    }
+                }
+                if (L.Native) {
+                    L.Native(Locals.data());
+                    PC = L.Exit;
+                }
+                break;
+            }
+            case Instr::JumpIfZero:
+                if (Stack[--SP] == 0)
+                    PC = I.Index;
+                break;
+        }
+    }
+    return Stack[0];
+}
+
+/// defineTiered - Make FnAST callable by the interpreter. Like the JIT, this
+/// resolves calls against the functions known so far.
+static bool defineTiered(std::unique_ptr<FunctionAST> FnAST) {
+    auto &P = FnAST->getProto();
+    Symbol S = P.getSymbol();
+    if (FunctionDefs.count(S)) {
+        LogError("Function cannot be redefined.");
+        return false;
+    }
+    // Later definitions call it through its prototype, and promotion needs
+    // the prototypes of its callees.
+    auto SavedProto = FunctionProtos.find(S) != FunctionProtos.end()
+                          ? std::make_unique<PrototypeAST>(*FunctionProtos[S])
+                          : nullptr;
+    FunctionProtos[S] = std::make_unique<PrototypeAST>(P);
+    bool WasExtern = Externs.erase(S);
+    bool Declared = TieredFunctions.count(S);
+    TieredFunction *F = getTieredFunction(S);
+    F->Arity = P.getArgs().size();
+    F->Native = nullptr;
+    F->PromotionFailed = false;
+    if (!compileFunction(*F, *FnAST)) {
+        F->Def = nullptr;
+        if (!Declared)
+            TieredFunctions.erase(S);
+        if (WasExtern)
+            Externs.insert(S);
+        if (SavedProto)
+            FunctionProtos[S] = std::move(SavedProto);
+        else
+            FunctionProtos.erase(S);
+        return false;
+    }
+    FunctionDefs[S] = std::move(FnAST);
+    return true;
+}
+
+/// evaluateTiered - Interpret the top-level expression FnAST into Result.
+static bool evaluateTiered(FunctionAST &FnAST, double &Result) {
+    TieredFunction F;
+    F.Name = FnAST.getProto().getSymbol();
+    F.Arity = 0;
+    if (!compileFunction(F, FnAST))
+        return false;
+    // Run once: never worth promoting as a whole, but its loops may be.
+    F.PromotionFailed = true;
+    Result = callTiered(F, nullptr);
+    return true;
+}
@@ -0,0 +1,437 @@
+#include<bits/stdc++.h>
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LazyReexports.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/Mangling.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Target/TargetOptions.h"
+
+
+//===----------------------------------------------------------------------===//
+// JIT
+//===----------------------------------------------------------------------===//
+
+/// NotifyCompiledFn - Told about each module the JIT has turned into an
+/// object: how long machine code generation took and how big the object is.
+/// Runs on the compiling thread.
+typedef std::function<void(llvm::Module &, double Seconds, size_t ObjectBytes)>
+    NotifyCompiledFn;
+
+/// PerfMapListener - Appends a line for every function the JIT loads to
+/// /tmp/perf-PID.map, where perf looks up the names of addresses that are
+/// not in any mapped file. Plain "perf record" and "perf report" then show
+/// JIT'd functions by name, with none of jitdump's extra steps. The map is
+/// append-only, so a stale entry can outlive code that was freed: JIT'd
+/// function names should not be reused.
+class PerfMapListener : public llvm::JITEventListener {
+    std::mutex Lock;
+    FILE *Map;
+
+    public:
+        PerfMapListener() {
+            std::string Path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+            Map = fopen(Path.c_str(), "w");
+            if (!Map)
+                fprintf(stderr, "Warning: cannot write %s: %s\n", Path.c_str(), strerror(errno));
+        }
+
+        ~PerfMapListener() override {
+            if (Map)
+                fclose(Map);
+        }
+
+        void notifyObjectLoaded(ObjectKey, const llvm::object::ObjectFile &Obj,
+                                const llvm::RuntimeDyld::LoadedObjectInfo &L) override {
+            if (!Map)
+                return;
+            // The debug object has its sections at their load addresses.
+            auto DebugObj = L.getObjectForDebug(Obj);
+            const llvm::object::ObjectFile &O = DebugObj.getBinary() ? *DebugObj.getBinary() : Obj;
+            std::lock_guard<std::mutex> Guard(Lock);
+            for (auto &P : llvm::object::computeSymbolSizes(O)) {
+                llvm::object::SymbolRef Sym = P.first;
+                auto Type = Sym.getType();
+                auto Name = Sym.getName();
+                auto Addr = Sym.getAddress();
+                if (!Type || !Name || !Addr || *Type != llvm::object::SymbolRef::ST_Function) {
+                    llvm::consumeError(Type.takeError());
+                    llvm::consumeError(Name.takeError());
+                    llvm::consumeError(Addr.takeError());
+                    continue;
+                }
+                fprintf(Map, "%" PRIx64 " %" PRIx64 " %s\n", *Addr, P.second,
+                        Name->str().c_str());
+            }
+            fflush(Map);
+        }
+};
+
+/// PerThreadTargetMachines - One TargetMachine per thread for the target JTMB
+/// describes, created on first use. TargetMachines are not thread-safe, and
+/// building a new one per module (as ConcurrentIRCompiler does) costs more
+/// than compiling a small function.
+class PerThreadTargetMachines {
+    llvm::orc::JITTargetMachineBuilder JTMB;
+    std::mutex Lock;
+    std::map<std::thread::id, std::unique_ptr<llvm::TargetMachine>> TMs;
+
+    public:
+        PerThreadTargetMachines(llvm::orc::JITTargetMachineBuilder JTMB)
+            : JTMB(std::move(JTMB)) {}
+
+        const llvm::orc::JITTargetMachineBuilder &getBuilder() const { return JTMB; }
+
+        /// get - The calling thread's TargetMachine.
+        llvm::Expected<llvm::TargetMachine &> get() {
+            std::lock_guard<std::mutex> Guard(Lock);
+            auto &TM = TMs[std::this_thread::get_id()];
+            if (!TM) {
+                auto TMOrErr = JTMB.createTargetMachine();
+                if (!TMOrErr)
+                    return TMOrErr.takeError();
+                TM = std::move(*TMOrErr);
+            }
+            return *TM;
+        }
+};
+
+/// PerThreadIRCompiler - Compiles modules to objects on whichever thread the
+/// JIT runs the compile, with that thread's TargetMachine. ObjCache, if
+/// given, is offered every object compiled.
+class PerThreadIRCompiler : public llvm::orc::IRCompileLayer::IRCompiler {
+    std::shared_ptr<PerThreadTargetMachines> TMs;
+    NotifyCompiledFn NotifyCompiled;
+    llvm::ObjectCache *ObjCache;
+
+    public:
+        PerThreadIRCompiler(std::shared_ptr<PerThreadTargetMachines> TMs,
+                            NotifyCompiledFn NotifyCompiled = nullptr,
+                            llvm::ObjectCache *ObjCache = nullptr)
+            : IRCompiler(llvm::orc::irManglingOptionsFromTargetOptions(
+                  TMs->getBuilder().getOptions())),
+              TMs(std::move(TMs)), NotifyCompiled(std::move(NotifyCompiled)),
+              ObjCache(ObjCache) {}
+
+        llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> operator()(llvm::Module &M) override {
+            auto TM = TMs->get();
+            if (!TM)
+                return TM.takeError();
+            if (!NotifyCompiled)
+                return llvm::orc::SimpleCompiler(*TM, ObjCache)(M);
+
+            auto Start = std::chrono::steady_clock::now();
+            auto Obj = llvm::orc::SimpleCompiler(*TM, ObjCache)(M);
+            if (Obj)
+                NotifyCompiled(M, std::chrono::duration<double>(
+                                      std::chrono::steady_clock::now() - Start).count(),
+                               (*Obj)->getBufferSize());
+            return Obj;
+        }
+};
+
+/// lazyCompileFailed - Where a call through a lazy stub lands if its function
+/// failed to compile; the JIT has reported why by then.
+static void lazyCompileFailed() {
+    fprintf(stderr, "Error: lazily compiled function could not be compiled\n");
+    exit(1);
+}
+
+/// KaleidoscopeJIT - A thin wrapper around ORC's LLJIT exposing the interface
+/// the driver needs: add a module (optionally under its own ResourceTracker so
+/// it can be freed again), look a symbol up, and report the data layout that
+/// modules must be compiled for.
+///
+/// addLazyModule() defers all work on a module until one of its functions is
+/// first called: callers are linked against a stub, and the first call
+/// through it optimizes and compiles the module and patches the stub to jump
+/// straight to the code (ORC's lazy reexports).
+///
+/// Modules are optimized by the OptimizeModule option as the JIT materializes
+/// them, given a TargetMachine for the host so that the optimizer can query
+/// the target (vector width, costs). With NumCompileThreads > 0 that
+/// happens, together with machine code generation, on a pool of that many
+/// threads, one module per task; each module must then own its LLVMContext.
+///
+/// addRedirectableModule() puts a stub in front of a function, so that code
+/// already linked against it can be pointed at a new version later with
+/// redirect() (profile-guided re-optimization).
+///
+/// The pool is ours rather than LLJIT's so that removeModule() can wait for it
+/// to drain: the object layer records a module's memory against its tracker
+/// only after reporting its symbols ready, so a tracker removed straight after
+/// a lookup could otherwise still be in use on a compile thread.
+class KaleidoscopeJIT {
+    std::unique_ptr<llvm::ThreadPool> CompileThreads;
+    // Outlive the session, whose pending stubs refer to them.
+    std::unique_ptr<llvm::orc::LazyCallThroughManager> CallThroughs;
+    std::unique_ptr<llvm::orc::IndirectStubsManager> Stubs;
+    std::unique_ptr<llvm::orc::LLLazyJIT> TheLLJIT;
+    llvm::orc::MangleAndInterner Mangle;
+    std::string TargetDescription;
+
+    public:
+        typedef std::function<void(llvm::Module &, llvm::TargetMachine *)> OptimizeFn;
+
+        struct Options {
+            unsigned NumCompileThreads = 0;
+            OptimizeFn OptimizeModule;
+            llvm::CodeGenOpt::Level CodeGenOptLevel = llvm::CodeGenOpt::Default;
+            llvm::TargetOptions TargetOptions;
+            /// CPU and comma-separated Features to generate code for; the
+            /// host's if CPU is empty.
+            std::string CPU, Features;
+            NotifyCompiledFn NotifyCompiled;
+            llvm::ObjectCache *ObjCache = nullptr;
+        };
+
+        KaleidoscopeJIT(std::unique_ptr<llvm::ThreadPool> Pool,
+                        std::unique_ptr<llvm::orc::LazyCallThroughManager> CallThroughs,
+                        std::unique_ptr<llvm::orc::IndirectStubsManager> Stubs,
+                        std::unique_ptr<llvm::orc::LLLazyJIT> J,
+                        std::string TargetDescription)
+            : CompileThreads(std::move(Pool)), CallThroughs(std::move(CallThroughs)),
+              Stubs(std::move(Stubs)), TheLLJIT(std::move(J)),
+              Mangle(TheLLJIT->getExecutionSession(), TheLLJIT->getDataLayout()),
+              TargetDescription(std::move(TargetDescription)) {}
+
+        ~KaleidoscopeJIT() {
+            // Let background compiles finish before the session goes away.
+            waitForCompiles();
+        }
+
+        static llvm::Expected<std::unique_ptr<KaleidoscopeJIT>>
+        Create(const Options &Opts) {
+            auto JTMB = llvm::orc::JITTargetMachineBuilder::detectHost();
+            if (!JTMB)
+                return JTMB.takeError();
+            JTMB->setCodeGenOptLevel(Opts.CodeGenOptLevel);
+            JTMB->getOptions() = Opts.TargetOptions;
+            if (!Opts.CPU.empty()) {
+                JTMB->setCPU(Opts.CPU);
+                JTMB->getFeatures() = llvm::SubtargetFeatures(Opts.Features);
+            }
+            std::string TargetDescription = JTMB->getTargetTriple().str() + " " +
+                                            JTMB->getCPU() + " " +
+                                            JTMB->getFeatures().getString();
+
+            auto TMs = std::make_shared<PerThreadTargetMachines>(*JTMB);
+            llvm::orc::LLLazyJITBuilder Builder;
+            Builder.setJITTargetMachineBuilder(std::move(*JTMB));
+            Builder.setLazyCompileFailureAddr(
+                llvm::pointerToJITTargetAddress(&lazyCompileFailed));
+            Builder.setCompileFunctionCreator(
+                [TMs, Notify = Opts.NotifyCompiled, ObjCache = Opts.ObjCache](
+                    llvm::orc::JITTargetMachineBuilder)
+                    -> llvm::Expected<std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>> {
+                    return std::make_unique<PerThreadIRCompiler>(TMs, Notify, ObjCache);
+                });
+            std::unique_ptr<llvm::ThreadPool> Pool;
+            if (Opts.NumCompileThreads)
+                Pool = std::make_unique<llvm::ThreadPool>(
+                    llvm::hardware_concurrency(Opts.NumCompileThreads));
+
+            auto J = Builder.create();
+            if (!J)
+                return J.takeError();
+
+            // Each module defines a single function: compile lazy modules
+            // whole rather than splitting them further.
+            (*J)->setPartitionFunction(llvm::orc::CompileOnDemandLayer::compileWholeModule);
+
+            if (Pool) {
+                llvm::ThreadPool *P = Pool.get();
+                (*J)->getExecutionSession().setDispatchTask(
+                    [P](std::unique_ptr<llvm::orc::Task> T) {
+                        // ThreadPool wants a copyable callable.
+                        auto *Unowned = T.release();
+                        P->async([Unowned]() {
+                            std::unique_ptr<llvm::orc::Task> T(Unowned);
+                            T->run();
+                        });
+                    });
+            }
+
+            if (auto OptimizeModule = Opts.OptimizeModule)
+                (*J)->getIRTransformLayer().setTransform(
+                    [OptimizeModule, TMs](llvm::orc::ThreadSafeModule TSM,
+                                          llvm::orc::MaterializationResponsibility &)
+                        -> llvm::Expected<llvm::orc::ThreadSafeModule> {
+                        auto TM = TMs->get();
+                        if (!TM)
+                            return TM.takeError();
+                        TSM.withModuleDo([&](llvm::Module &M) { OptimizeModule(M, &*TM); });
+                        return TSM;
+                    });
+
+            // Let 'extern' declarations resolve against symbols in this
+            // process, e.g. sin/cos from libm.
+            auto Gen = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+                (*J)->getDataLayout().getGlobalPrefix());
+            if (!Gen)
+                return Gen.takeError();
+            (*J)->getMainJITDylib().addGenerator(std::move(*Gen));
+
+            auto CallThroughs = llvm::orc::createLocalLazyCallThroughManager(
+                (*J)->getTargetTriple(), (*J)->getExecutionSession(),
+                llvm::pointerToJITTargetAddress(&lazyCompileFailed));
+            if (!CallThroughs)
+                return CallThroughs.takeError();
+            auto Stubs =
+                llvm::orc::createLocalIndirectStubsManagerBuilder((*J)->getTargetTriple())();
+
+            return std::make_unique<KaleidoscopeJIT>(std::move(Pool), std::move(*CallThroughs),
+                                                     std::move(Stubs), std::move(*J),
+                                                     std::move(TargetDescription));
+        }
+
+        const llvm::DataLayout &getDataLayout() const { return TheLLJIT->getDataLayout(); }
+        const llvm::Triple &getTargetTriple() const { return TheLLJIT->getTargetTriple(); }
+
+        /// getTargetDescription - Triple, CPU and features code is compiled
+        /// for: everything about the target that the generated code depends on.
+        const std::string &getTargetDescription() const { return TargetDescription; }
+
+        llvm::orc::JITDylib &getMainJITDylib() { return TheLLJIT->getMainJITDylib(); }
+
+        /// addEventListener - Tell L about every object the JIT loads from
+        /// now on, e.g. to register its functions with a profiler or
+        /// debugger. L must outlive the JIT.
+        llvm::Error addEventListener(llvm::JITEventListener &L) {
+            auto *RTDyld = llvm::dyn_cast<llvm::orc::RTDyldObjectLinkingLayer>(
+                &TheLLJIT->getObjLinkingLayer());
+            if (!RTDyld)
+                return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                               "the JIT's linker does not support event listeners");
+            RTDyld->registerJITEventListener(L);
+            return llvm::Error::success();
+        }
+
+        /// addModule - Hand a module to the JIT. If RT is null the module lives
+        /// for the rest of the session, otherwise removing RT frees its code.
+        llvm::Error addModule(llvm::orc::ThreadSafeModule TSM,
+                              llvm::orc::ResourceTrackerSP RT = nullptr) {
+            if (!RT)
+                RT = getMainJITDylib().getDefaultResourceTracker();
+            return TheLLJIT->addIRModule(RT, std::move(TSM));
+        }
+
+        /// addLazyModule - Hand the JIT a module to optimize and compile only
+        /// when one of its functions is first called.
+        llvm::Error addLazyModule(llvm::orc::ThreadSafeModule TSM) {
+            return TheLLJIT->addLazyIRModule(std::move(TSM));
+        }
+
+        /// addRedirectableModule - Hand the JIT a module defining Impl, and
+        /// define Name as a stub that jumps to it. Callers link against the
+        /// stub, and Impl is compiled when it is first called through it.
+        llvm::Error addRedirectableModule(llvm::orc::ThreadSafeModule TSM,
+                                          llvm::StringRef Name, llvm::StringRef Impl) {
+            if (auto Err = addModule(std::move(TSM)))
+                return Err;
+            llvm::orc::SymbolAliasMap Aliases;
+            Aliases[Mangle(Name)] = llvm::orc::SymbolAliasMapEntry(
+                Mangle(Impl), llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable);
+            return getMainJITDylib().define(llvm::orc::lazyReexports(
+                *CallThroughs, *Stubs, getMainJITDylib(), std::move(Aliases)));
+        }
+
+        /// redirect - Make the stub Name (see addRedirectableModule) jump to
+        /// Impl from now on, compiling Impl first if need be. Safe to call
+        /// while other threads are calling through the stub.
+        llvm::Error redirect(llvm::StringRef Name, llvm::StringRef Impl) {
+            auto Sym = lookup(Impl);
+            if (!Sym)
+                return Sym.takeError();
+            return Stubs->updatePointer(*Mangle(Name), Sym->getAddress());
+        }
+
+        /// addObjectFile - Hand the JIT an object compiled earlier, e.g. by
+        /// another process, to link in place of a module.
+        llvm::Error addObjectFile(std::unique_ptr<llvm::MemoryBuffer> Obj) {
+            return TheLLJIT->addObjectFile(std::move(Obj));
+        }
+
+        /// removeModule - Free everything added under RT.
+        llvm::Error removeModule(llvm::orc::ResourceTrackerSP RT) {
+            waitForCompiles();
+            return RT->remove();
+        }
+
+        llvm::Expected<llvm::JITEvaluatedSymbol> lookup(llvm::StringRef Name) {
+            return TheLLJIT->lookup(Name);
+        }
+
+        llvm::Expected<llvm::JITEvaluatedSymbol> lookup(llvm::orc::JITDylib &JD,
+                                                        llvm::StringRef Name) {
+            return TheLLJIT->lookup(JD, Name);
+        }
+
+        /// createJITDylib - A JITDylib for code that must not see, or clash
+        /// with, anyone else's definitions but those of the main JITDylib,
+        /// which it links against (a server session).
+        llvm::Expected<llvm::orc::JITDylib &> createJITDylib(llvm::StringRef Name) {
+            auto JD = TheLLJIT->createJITDylib(Name.str());
+            if (!JD)
+                return JD.takeError();
+            JD->addToLinkOrder(getMainJITDylib());
+            return *JD;
+        }
+
+        /// removeJITDylib - Free JD and everything in it.
+        llvm::Error removeJITDylib(llvm::orc::JITDylib &JD) {
+            waitForCompiles();
+            return TheLLJIT->getExecutionSession().removeJITDylib(JD);
+        }
+
+        /// materialize - Compile everything needed to define Names in a single
+        /// lookup, so the JIT can hand the modules to its compile threads all
+        /// at once rather than one after the other.
+        llvm::Error materialize(llvm::ArrayRef<llvm::StringRef> Names) {
+            llvm::orc::SymbolLookupSet Symbols;
+            for (llvm::StringRef Name : Names)
+                Symbols.add(Mangle(Name));
+            auto &ES = TheLLJIT->getExecutionSession();
+            return ES.lookup(llvm::orc::makeJITDylibSearchOrder(&getMainJITDylib()),
+                             std::move(Symbols))
+                .takeError();
+        }
+
+        /// materializeAsync - Start compiling everything needed to define
+        /// Names without waiting for it. Compiles on the calling thread
+        /// unless the JIT has compile threads. Call waitForCompiles() before
+        /// running code: a lookup that overlaps these compiles can return an
+        /// address whose code the object layer has not made executable yet.
+        void materializeAsync(llvm::ArrayRef<llvm::StringRef> Names) {
+            llvm::orc::SymbolLookupSet Symbols;
+            for (llvm::StringRef Name : Names)
+                Symbols.add(Mangle(Name));
+            auto &ES = TheLLJIT->getExecutionSession();
+            ES.lookup(llvm::orc::LookupKind::Static,
+                      llvm::orc::makeJITDylibSearchOrder(&getMainJITDylib()),
+                      std::move(Symbols), llvm::orc::SymbolState::Ready,
+                      [&ES](llvm::Expected<llvm::orc::SymbolMap> Result) {
+                          if (!Result)
+                              ES.reportError(Result.takeError());
+                      },
+                      llvm::orc::NoDependenciesToRegister);
+        }
+
+        /// waitForCompiles - Block until the compile threads are idle.
+        void waitForCompiles() {
+            if (CompileThreads)
+                CompileThreads->wait();
+        }
+};
@@ -1,76 +1,293 @@
 #include<bits/stdc++.h>
+#include <unistd.h>
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/MemoryBuffer.h"
 
 enum token{
     tok_eof = -1,
-    
+
     tok_def = -2,
     tok_extern = -3,
 
     tok_identifier = -4,
     tok_number = -5,
 
+    // control flow and locals
+    tok_if = -6,
+    tok_then = -7,
+    tok_else = -8,
+    tok_for = -9,
+    tok_in = -10,
+    tok_while = -11,
+    tok_do = -12,
+    tok_var = -13,
 };
 
-static std::string IdentifierStr;
-static double NumVal;
-
-static int gettok() {
-    static int LastChar = ' ';
-
-    // Skip any whitespace.
-    while (isspace(LastChar))
-       LastChar = getchar();
-    
-    if(isalpha(LastChar)) {  // identifier: [a-zA-Z][a-zA-Z0-9]*
-        IdentifierStr = LastChar;
-        while(isalnum((LastChar = getchar())))
-            IdentifierStr += LastChar;
-        
-        if (IdentifierStr == "def")
-            return tok_def;
-            
-        if (IdentifierStr == "extern")
-            return tok_extern;
-
-        return tok_identifier;
-    }
 
-    if(isdigit(LastChar) || LastChar == '.'){ // Number: [0-9.]+
-        std::string NumStr;
+//===----------------------------------------------------------------------===//
+// Symbols
+//===----------------------------------------------------------------------===//
+
+/// Symbol - An interned identifier. Every distinct name is given a small dense
+/// integer the first time a lexer sees it, so the rest of the compiler
+/// compares and hashes integers instead of strings and can use symbols as
+/// table indices. Symbols are shared by every thread in the process.
+typedef unsigned Symbol;
+
+/// SymbolTable - The interner behind internSymbol()/getSymbolName(). Lexers
+/// on any number of threads may intern concurrently: names are spread over
+/// shards by hash, each with its own lock, so they rarely contend. Looking a
+/// symbol's name up takes no lock; names are kept in chunks that never move
+/// once allocated, and a symbol is only handed out after its name is stored.
+class SymbolTable {
+    enum { NumShards = 16, ChunkBits = 12, ChunkSize = 1 << ChunkBits, MaxChunks = 1 << 16 };
+
+    struct Shard {
+        std::mutex Lock;
+        llvm::StringMap<Symbol, llvm::BumpPtrAllocator> Ids;
+    };
 
-        do{
-            NumStr += LastChar;
-            LastChar = getchar();
-        }while(isdigit(LastChar) || LastChar == '.');
+    Shard Shards[NumShards];
+    std::atomic<Symbol> NextSymbol{0};
+    std::mutex ChunkLock;
+    std::atomic<llvm::StringRef *> Chunks[MaxChunks] = {};
 
-        NumVal = strtod(NumStr.c_str(),0);
-        return tok_number;
+    /// slot - Where S's name goes, allocating its chunk if need be.
+    llvm::StringRef &slot(Symbol S) {
+        auto &Chunk = Chunks[S >> ChunkBits];
+        llvm::StringRef *Names = Chunk.load(std::memory_order_acquire);
+        if (!Names) {
+            std::lock_guard<std::mutex> Guard(ChunkLock);
+            Names = Chunk.load(std::memory_order_relaxed);
+            if (!Names) {
+                Names = new llvm::StringRef[ChunkSize];
+                Chunk.store(Names, std::memory_order_release);
+            }
+        }
+        return Names[S & (ChunkSize - 1)];
     }
 
-    //comment handling
-    if (LastChar == '#'){
+    public:
+        SymbolTable() = default;
+        SymbolTable(const SymbolTable &) = delete;
+        SymbolTable &operator=(const SymbolTable &) = delete;
+
+        ~SymbolTable() {
+            for (auto &Chunk : Chunks)
+                delete[] Chunk.load(std::memory_order_relaxed);
+        }
+
+        Symbol intern(llvm::StringRef Name) {
+            Shard &S = Shards[llvm::hash_value(Name) % NumShards];
+            std::lock_guard<std::mutex> Guard(S.Lock);
+            auto Ins = S.Ids.try_emplace(Name, 0);
+            if (Ins.second) {
+                Symbol Sym = NextSymbol.fetch_add(1, std::memory_order_relaxed);
+                assert(Sym < (Symbol)MaxChunks * ChunkSize && "too many symbols");
+                // The names point at the StringMap's keys, which never move.
+                slot(Sym) = Ins.first->getKey();
+                Ins.first->getValue() = Sym;
+            }
+            return Ins.first->getValue();
+        }
+
+        llvm::StringRef getName(Symbol S) const {
+            return Chunks[S >> ChunkBits].load(std::memory_order_acquire)[S & (ChunkSize - 1)];
+        }
+};
+
+static SymbolTable Symbols;
+
+static Symbol internSymbol(llvm::StringRef Name) { return Symbols.intern(Name); }
+
+static llvm::StringRef getSymbolName(Symbol S) { return Symbols.getName(S); }
+
+/// Keywords are interned up front so the lexer can recognise them by symbol.
+static const Symbol Sym_def = internSymbol("def");
+static const Symbol Sym_extern = internSymbol("extern");
+static const Symbol Sym_if = internSymbol("if");
+static const Symbol Sym_then = internSymbol("then");
+static const Symbol Sym_else = internSymbol("else");
+static const Symbol Sym_for = internSymbol("for");
+static const Symbol Sym_in = internSymbol("in");
+static const Symbol Sym_while = internSymbol("while");
+static const Symbol Sym_do = internSymbol("do");
+static const Symbol Sym_var = internSymbol("var");
+
+
+//===----------------------------------------------------------------------===//
+// Lexer
+//===----------------------------------------------------------------------===//
+
+/// Lexer - Turns one input into tokens. All of its state is its own, so
+/// lexers for different inputs may run on different threads.
+///
+/// The lexer scans the window [CurPtr, BufEnd). For a file or an in-memory
+/// buffer that window is the whole input; for a stream it is a block buffer
+/// which is refilled with read() once exhausted. On refill, everything from
+/// TokStart onwards is slid to the front first so that the token being
+/// scanned stays contiguous.
+class Lexer {
+    const char *CurPtr = nullptr;
+    const char *BufEnd = nullptr;
+    const char *TokStart = nullptr;
+
+    std::unique_ptr<llvm::MemoryBuffer> InputFile;
+    std::vector<char> StreamBuf;
+    int StreamFD = 0; // stdin until told otherwise, -1 once exhausted.
+
+    enum { StreamBlockSize = 64 * 1024 };
+
+    /// IdentifierStr - Text of the last tok_identifier. It points straight
+    /// into the input buffer, so it is only valid until the next call to
+    /// gettok(). IdentifierSym is its interned symbol, which stays valid for
+    /// good.
+    llvm::StringRef IdentifierStr;
+    Symbol IdentifierSym = 0;
+    double NumVal = 0;
+
+    /// refillBuffer - Make more input available after BufEnd, keeping the
+    /// bytes from TokStart onwards. Returns false at end of input.
+    bool refillBuffer() {
+        if (StreamFD < 0)
+            return false;
+
+        // Work in offsets: growing StreamBuf may move it.
+        size_t Start = TokStart ? TokStart - StreamBuf.data() : 0;
+        size_t Keep = TokStart ? BufEnd - TokStart : 0;
+        size_t Cur = TokStart ? CurPtr - TokStart : 0;
+        if (StreamBuf.size() < Keep + StreamBlockSize)
+            StreamBuf.resize(Keep + StreamBlockSize);
+        if (Keep)
+            memmove(StreamBuf.data(), StreamBuf.data() + Start, Keep);
+
+        ssize_t N;
         do
-        {
-            LastChar = getchar();
-        } while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
+            N = read(StreamFD, StreamBuf.data() + Keep, StreamBuf.size() - Keep);
+        while (N < 0 && errno == EINTR);
 
-        if (LastChar !=EOF)
-            return gettok();
+        TokStart = StreamBuf.data();
+        CurPtr = TokStart + Cur;
+        BufEnd = TokStart + Keep + (N > 0 ? N : 0);
+        if (N <= 0) {
+            StreamFD = -1;
+            return false;
+        }
+        return true;
     }
 
-    //check for EOF
-    if(LastChar == EOF)
-        return tok_eof;
-    
-    //otherwise, just return the character as it's ascii value.
-    int ThisChar = LastChar;
-    LastChar = getchar();
-    return ThisChar;
-}
+    /// peekChar - The next unconsumed character, or EOF.
+    int peekChar() {
+        if (CurPtr == BufEnd && !refillBuffer())
+            return EOF;
+        return (unsigned char)*CurPtr;
+    }
+
+    public:
+        /// setBuffer - Lex Buf directly. The memory must outlive the lexer's use.
+        void setBuffer(llvm::StringRef Buf) {
+            CurPtr = TokStart = Buf.begin();
+            BufEnd = Buf.end();
+            StreamFD = -1;
+        }
+
+        /// setFile - Lex the named file, memory-mapping it when that pays off.
+        bool setFile(llvm::StringRef Filename) {
+            auto FileOrErr = llvm::MemoryBuffer::getFile(Filename, /*IsText=*/true,
+                                                         /*RequiresNullTerminator=*/false);
+            if (!FileOrErr) {
+                fprintf(stderr, "Error: cannot open '%s': %s\n", Filename.str().c_str(),
+                        FileOrErr.getError().message().c_str());
+                return false;
+            }
+            InputFile = std::move(*FileOrErr);
+            setBuffer(InputFile->getBuffer());
+            return true;
+        }
+
+        /// setStream - Lex whatever can be read() from FD, a block at a time.
+        void setStream(int FD) {
+            InputFile.reset();
+            CurPtr = BufEnd = TokStart = nullptr;
+            StreamFD = FD;
+        }
+
+        llvm::StringRef getIdentifierStr() const { return IdentifierStr; }
+        Symbol getIdentifierSym() const { return IdentifierSym; }
+        double getNumVal() const { return NumVal; }
+
+        int gettok() {
+            while (true) {
+                // Skip any whitespace.
+                int LastChar;
+                TokStart = CurPtr;
+                while (llvm::isSpace(LastChar = peekChar()))
+                    TokStart = ++CurPtr;
+
+                if(llvm::isAlpha(LastChar)) {  // identifier: [a-zA-Z][a-zA-Z0-9]*
+                    do
+                        ++CurPtr;
+                    while (llvm::isAlnum(peekChar()));
+                    IdentifierStr = llvm::StringRef(TokStart, CurPtr - TokStart);
+                    IdentifierSym = internSymbol(IdentifierStr);
+
+                    if (IdentifierSym == Sym_def)
+                        return tok_def;
+
+                    if (IdentifierSym == Sym_extern)
+                        return tok_extern;
+
+                    // The keywords were interned first, in token order.
+                    if (IdentifierSym >= Sym_if && IdentifierSym <= Sym_var)
+                        return tok_if - (IdentifierSym - Sym_if);
+
+                    return tok_identifier;
+                }
+
+                if(llvm::isDigit(LastChar) || LastChar == '.'){ // Number: [0-9.]+
+                    do
+                        ++CurPtr;
+                    while (llvm::isDigit(LastChar = peekChar()) || LastChar == '.');
+
+                    // The buffer is not NUL-terminated after the token, so strtod
+                    // gets a short copy.
+                    llvm::SmallString<32> NumStr(llvm::StringRef(TokStart, CurPtr - TokStart));
+                    NumVal = strtod(NumStr.c_str(),0);
+                    return tok_number;
+                }
+
+                //comment handling
+                if (LastChar == '#'){
+                    do
+                    {
+                        ++CurPtr;
+                        TokStart = CurPtr;
+                        LastChar = peekChar();
+                    } while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
+
+                    if (LastChar != EOF)
+                        continue;
+                }
+
+                //check for EOF
+                if(LastChar == EOF)
+                    return tok_eof;
+
+                //otherwise, just return the character as it's ascii value.
+                ++CurPtr;
+                return LastChar;
+            }
+        }
+};
 
 // int main(){
 //     while(true){
 //         int tok = gettok();
 //         std::cout<<"got token: "<<tok<<"\n";
 //     }
-// }
\ No newline at end of file
+// }
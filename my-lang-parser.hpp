@@ -1,7 +1,11 @@
 #include<bits/stdc++.h>
 #include "my-lang-lexer.hpp"
+#include "my-lang-stats.hpp"
 #include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Any.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
@@ -12,15 +16,73 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/Casting.h"
 
 
 ///Abstract Syntax Tree
 
-//base class for all expression nodes
+/// ASTArena - Bump allocator owning every expression node of one top-level
+/// item. Nodes are never destroyed individually: the whole tree goes away in
+/// one shot together with the arena, so nodes must be trivially destructible
+/// (argument lists are copied into the arena as well; names are Symbols).
+class ASTArena {
+    llvm::BumpPtrAllocator Alloc;
+    size_t NumNodes = 0;
+
+    public:
+        template <typename T, typename... ArgTs>
+        T *create(ArgTs &&...Args) {
+            static_assert(std::is_trivially_destructible<T>::value,
+                          "arena nodes are never destroyed");
+            ++NumNodes;
+            return new (Alloc.Allocate<T>()) T(std::forward<ArgTs>(Args)...);
+        }
+
+        template <typename T>
+        llvm::ArrayRef<T> copyArray(llvm::ArrayRef<T> A) {
+            T *Buf = Alloc.Allocate<T>(A.size());
+            std::uninitialized_copy(A.begin(), A.end(), Buf);
+            return llvm::ArrayRef<T>(Buf, A.size());
+        }
+
+        size_t getBytesAllocated() const { return Alloc.getBytesAllocated(); }
+        size_t getNumNodes() const { return NumNodes; }
+};
+
+//base class for all expression nodes. There are no virtual functions: each
+//node carries a kind tag, which codegen() switches over and which backs
+//isa<>/cast<>/dyn_cast<> through the classof() hooks. Machine-generated
+//expressions can nest arbitrarily deep, so nothing walks the tree by
+//recursion: see walkPostorder().
 class ExprAST {
     public:
-        virtual ~ExprAST() {}
-        virtual llvm::Value *codegen() = 0;
+        enum ExprKind : uint8_t {
+            EK_Number,
+            EK_Variable,
+            EK_Binary,
+            EK_Call,
+            EK_If,
+            EK_For,
+            EK_While,
+            EK_Var,
+            EK_Assign,
+        };
+
+    private:
+        const ExprKind Kind;
+
+    protected:
+        ExprAST(ExprKind K) : Kind(K) {}
+
+    public:
+        ExprKind getKind() const { return Kind; }
+
+        /// Operands, in the order they are evaluated.
+        unsigned getNumChildren() const;
+        const ExprAST *getChild(unsigned I) const;
+
+        llvm::Value *codegen();
 };
 
 
@@ -29,210 +91,455 @@ class NumberExprAST : public ExprAST {
     double Val;
 
     public:
-        NumberExprAST(double Val) : Val(Val) {}
-        virtual llvm::Value *codegen();
+        NumberExprAST(double Val) : ExprAST(EK_Number), Val(Val) {}
+        double getVal() const { return Val; }
+        llvm::Value *codegen() const;
+
+        static bool classof(const ExprAST *E) { return E->getKind() == EK_Number; }
 };
 
 
 /// VariableExprAST - Expression class for referencing a variable, like "a".
 class VariableExprAST : public ExprAST {
-    std::string Name;
+    Symbol Name;
 
     public:
-        VariableExprAST(const std::string &Name) : Name(Name) {}
-        virtual llvm::Value *codegen();
+        VariableExprAST(Symbol Name) : ExprAST(EK_Variable), Name(Name) {}
+        Symbol getName() const { return Name; }
+        llvm::Value *codegen() const;
+
+        static bool classof(const ExprAST *E) { return E->getKind() == EK_Variable; }
 };
 
 
-/// BinaryExprAST - Expression class for a binary operator.
+/// BinaryExprAST - Expression class for a binary operator. ':' evaluates
+/// both operands, left to right, and yields the right one.
 class BinaryExprAST : public ExprAST {
     char Op;
-    std::unique_ptr<ExprAST> LHS, RHS;
+    ExprAST *LHS, *RHS;
 
     public:
-        BinaryExprAST(char op, std::unique_ptr<ExprAST> LHS, std::unique_ptr<ExprAST> RHS):
-            Op(op), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
-        
-        virtual llvm::Value *codegen();
+        BinaryExprAST(char op, ExprAST *LHS, ExprAST *RHS):
+            ExprAST(EK_Binary), Op(op), LHS(LHS), RHS(RHS) {}
+
+        char getOp() const { return Op; }
+        const ExprAST *getLHS() const { return LHS; }
+        const ExprAST *getRHS() const { return RHS; }
+        /// codegen - Apply the operator to its operands' values.
+        llvm::Value *codegen(llvm::Value *L, llvm::Value *R) const;
+
+        static bool classof(const ExprAST *E) { return E->getKind() == EK_Binary; }
 };
 
 
 /// CallExprAST - Expression class for function calls.
 class CallExprAST : public ExprAST {
-    std::string Callee;
-    std::vector<std::unique_ptr<ExprAST>> Args;
+    Symbol Callee;
+    llvm::ArrayRef<ExprAST *> Args;
 
     public:
-        CallExprAST(const std::string &Callee, std::vector<std::unique_ptr<ExprAST>> Args):
-            Callee(Callee), Args(std::move(Args)) {}
-        
-        virtual llvm::Value *codegen();
+        CallExprAST(Symbol Callee, llvm::ArrayRef<ExprAST *> Args):
+            ExprAST(EK_Call), Callee(Callee), Args(Args) {}
+
+        Symbol getCallee() const { return Callee; }
+        llvm::ArrayRef<ExprAST *> getArgs() const { return Args; }
+        /// codegen - Emit the call, given its arguments' values.
+        llvm::Value *codegen(llvm::ArrayRef<llvm::Value *> ArgsV) const;
+
+        static bool classof(const ExprAST *E) { return E->getKind() == EK_Call; }
 };
 
-/// PrototypeAST - This class represents the "prototype" for a function,
-/// which captures its name, and its argument names (thus implicitly the number
-/// of arguments the function takes).
+/// IfExprAST - Expression class for if/then/else. A condition is true if it
+/// is not 0.
+class IfExprAST : public ExprAST {
+    ExprAST *Cond, *Then, *Else;
+
+    public:
+        IfExprAST(ExprAST *Cond, ExprAST *Then, ExprAST *Else):
+            ExprAST(EK_If), Cond(Cond), Then(Then), Else(Else) {}
+
+        const ExprAST *getCond() const { return Cond; }
+        const ExprAST *getThen() const { return Then; }
+        const ExprAST *getElse() const { return Else; }
+
+        static bool classof(const ExprAST *E) { return E->getKind() == EK_If; }
+};
 
-class PrototypeAST{
-    std::string Name;
-    std::vector<std::string> Args;
+
+/// ForExprAST - Expression class for "for Var = Start, End, Step in Body":
+/// Var is a local initialized to Start, and for as long as End is true the
+/// body runs and Step is added to Var. End is tested before every
+/// iteration, the first included. End, Body and Step see Var; Step is 1 if
+/// left out. The loop evaluates to 0.
+class ForExprAST : public ExprAST {
+    Symbol Var;
+    ExprAST *Start, *End, *Body, *Step;
 
     public:
-        PrototypeAST(const std::string &Name, std::vector<std::string> Args):
-        Name(Name), Args(std::move(Args)) {}
+        ForExprAST(Symbol Var, ExprAST *Start, ExprAST *End, ExprAST *Body, ExprAST *Step):
+            ExprAST(EK_For), Var(Var), Start(Start), End(End), Body(Body), Step(Step) {}
 
-        const std::string &getName() const {return Name;}
+        Symbol getVar() const { return Var; }
+        const ExprAST *getStart() const { return Start; }
+        const ExprAST *getEnd() const { return End; }
+        const ExprAST *getBody() const { return Body; }
+        const ExprAST *getStep() const { return Step; }
 
-        virtual llvm::Function *codegen();
+        static bool classof(const ExprAST *E) { return E->getKind() == EK_For; }
 };
 
-/// FunctionAST - This class represents a function definition itself.
-class FunctionAST {
-    std::unique_ptr<PrototypeAST> Proto;
-    std::unique_ptr<ExprAST> Body;
+
+/// WhileExprAST - Expression class for "while Cond do Body", which
+/// evaluates to 0.
+class WhileExprAST : public ExprAST {
+    ExprAST *Cond, *Body;
 
     public:
-        FunctionAST(std::unique_ptr<PrototypeAST> Proto, std::unique_ptr<ExprAST> Body):
-            Proto(std::move(Proto)), Body(std::move(Body)) {}
-        
-        virtual llvm::Function *codegen();
+        WhileExprAST(ExprAST *Cond, ExprAST *Body):
+            ExprAST(EK_While), Cond(Cond), Body(Body) {}
+
+        const ExprAST *getCond() const { return Cond; }
+        const ExprAST *getBody() const { return Body; }
+
+        static bool classof(const ExprAST *E) { return E->getKind() == EK_While; }
+};
+
+
+/// VarExprAST - Expression class for "var a = 1, b in Body": locals, bound
+/// one after the other, so that each initializer sees the ones before it.
+/// A missing initializer is 0. Evaluates to Body.
+class VarExprAST : public ExprAST {
+    llvm::ArrayRef<Symbol> Names;
+    /// The initializers, then the body.
+    llvm::ArrayRef<ExprAST *> Operands;
+
+    public:
+        VarExprAST(llvm::ArrayRef<Symbol> Names, llvm::ArrayRef<ExprAST *> Operands):
+            ExprAST(EK_Var), Names(Names), Operands(Operands) {}
+
+        llvm::ArrayRef<Symbol> getNames() const { return Names; }
+        llvm::ArrayRef<ExprAST *> getInits() const { return Operands.drop_back(); }
+        const ExprAST *getBody() const { return Operands.back(); }
+        llvm::ArrayRef<ExprAST *> getOperands() const { return Operands; }
+
+        static bool classof(const ExprAST *E) { return E->getKind() == EK_Var; }
 };
 
 
-///Function Protoypes:
-static std::unique_ptr<ExprAST> ParseExpression();
-static std::unique_ptr<ExprAST> ParseBinOpRHS(int,std::unique_ptr<ExprAST>);
+/// AssignExprAST - Expression class for "Name = Value", which evaluates to
+/// Value. Name may be an argument or a local.
+class AssignExprAST : public ExprAST {
+    Symbol Name;
+    ExprAST *Value;
 
+    public:
+        AssignExprAST(Symbol Name, ExprAST *Value):
+            ExprAST(EK_Assign), Name(Name), Value(Value) {}
 
-/// CurTok/getNextToken - Provide a simple token buffer.  CurTok is the current
-/// token the parser is looking at.  getNextToken reads another token from the
-/// lexer and updates CurTok with its results.
-static int CurTok;
-static int getNextToken(){
-    return CurTok = gettok();
-}
+        Symbol getName() const { return Name; }
+        const ExprAST *getValue() const { return Value; }
 
+        static bool classof(const ExprAST *E) { return E->getKind() == EK_Assign; }
+};
 
-/// LogError* - These are little helper functions for error handling.
-std::unique_ptr<ExprAST> LogError(const char *Str){
-    fprintf(stderr, "LogError: %s\n", Str);
-    return nullptr;
+/// A for loop's body comes before its step, which runs after it.
+inline unsigned ExprAST::getNumChildren() const {
+    switch (Kind) {
+        case EK_Number:
+        case EK_Variable:
+            return 0;
+        case EK_Binary:
+            return 2;
+        case EK_Call:
+            return llvm::cast<CallExprAST>(this)->getArgs().size();
+        case EK_If:
+            return 3;
+        case EK_For:
+            return 4;
+        case EK_While:
+            return 2;
+        case EK_Var:
+            return llvm::cast<VarExprAST>(this)->getOperands().size();
+        case EK_Assign:
+            return 1;
+    }
+    llvm_unreachable("unknown expression kind");
 }
 
-std::unique_ptr<PrototypeAST> LogErrorP(const char *Str) {
-    LogError(Str);
-    return nullptr;
+inline const ExprAST *ExprAST::getChild(unsigned I) const {
+    switch (Kind) {
+        case EK_Binary: {
+            auto *B = llvm::cast<BinaryExprAST>(this);
+            return I == 0 ? B->getLHS() : B->getRHS();
+        }
+        case EK_Call:
+            return llvm::cast<CallExprAST>(this)->getArgs()[I];
+        case EK_If: {
+            auto *If = llvm::cast<IfExprAST>(this);
+            return I == 0 ? If->getCond() : I == 1 ? If->getThen() : If->getElse();
+        }
+        case EK_For: {
+            auto *For = llvm::cast<ForExprAST>(this);
+            const ExprAST *Children[] = {For->getStart(), For->getEnd(), For->getBody(),
+                                         For->getStep()};
+            return Children[I];
+        }
+        case EK_While: {
+            auto *W = llvm::cast<WhileExprAST>(this);
+            return I == 0 ? W->getCond() : W->getBody();
+        }
+        case EK_Var:
+            return llvm::cast<VarExprAST>(this)->getOperands()[I];
+        case EK_Assign:
+            return llvm::cast<AssignExprAST>(this)->getValue();
+        default:
+            llvm_unreachable("expression has no children");
+    }
 }
-/// identifierexpr
-///   ::= identifier
-///   ::= identifier '(' expression* ')'
 
-///Basic Expression Parsing
+/// walkPostorder - Call Visit on every node under Root, each after all of its
+/// children, left to right. Pending nodes are kept on an explicit stack, so
+/// the depth of the tree costs heap, not native stack. Stops, returning
+/// false, as soon as Visit does. Nodes for which Descend returns false are
+/// visited without their children: trees may share subtrees (see
+/// ExprBuilder), which a walker that has seen them once can skip. Enter is
+/// called with a node and the index of a child before that child is walked,
+/// for walkers that must act between children (branches, scopes); it stops
+/// the walk too by returning false.
+template <typename VisitFn, typename DescendFn, typename EnterFn>
+static bool walkPostorder(const ExprAST *Root, VisitFn Visit, DescendFn Descend, EnterFn Enter) {
+    struct Frame {
+        const ExprAST *E;
+        unsigned NextChild;
+    };
+    llvm::SmallVector<Frame, 32> Stack;
+    Stack.push_back({Root, Descend(Root) ? 0 : ~0u});
+    while (!Stack.empty()) {
+        Frame &F = Stack.back();
+        if (F.NextChild < F.E->getNumChildren()) {
+            const ExprAST *E = F.E;
+            unsigned I = F.NextChild++;
+            if (!Enter(E, I))
+                return false;
+            const ExprAST *Child = E->getChild(I);
+            Stack.push_back({Child, Descend(Child) ? 0 : ~0u});
+            continue;
+        }
+        const ExprAST *E = F.E;
+        Stack.pop_back();
+        if (!Visit(E))
+            return false;
+    }
+    return true;
+}
 
-/// numberexpr ::= number
-static std::unique_ptr<ExprAST> ParseNumberExpr() {
-    auto Result = std::make_unique<NumberExprAST>(NumVal);
-    getNextToken(); //consume the number
-    return std::move(Result);
+template <typename VisitFn, typename DescendFn>
+static bool walkPostorder(const ExprAST *Root, VisitFn Visit, DescendFn Descend) {
+    return walkPostorder(Root, Visit, Descend, [](const ExprAST *, unsigned) { return true; });
 }
 
-/// parenexpr ::= '(' expression ')'
-static std::unique_ptr<ExprAST> ParseParenExpr() {
-    getNextToken(); //eat (.
-    auto V = ParseExpression();
-    if(!V)
-        return nullptr;
-    
-    if(CurTok != ')')
-        return LogError("expected ')'");
-    getNextToken(); //eat ).
-    return V;
+template <typename VisitFn>
+static bool walkPostorder(const ExprAST *Root, VisitFn Visit) {
+    return walkPostorder(Root, Visit, [](const ExprAST *) { return true; });
 }
 
+/// ExprBuilder - Creates the nodes of one expression in an arena, bottom up,
+/// and with Simplify set cleans them up on the way, so that less IR is
+/// generated for LLVM to clean up:
+///
+///  - operators on two numbers are folded, with the same IEEE arithmetic as
+///    the generated code would do;
+///  - identities that hold for every double, including -0, infinities and
+///    NaN, are applied: x*1, 1*x, x-0, x+(-0) and (-0)+x are x;
+///  - structurally identical subtrees are hash-consed into one node, which
+///    codegen then emits once. Calls are never merged, because an extern
+///    may have side effects, and so neither is anything that contains one.
+///    Nor are assignments, branches and loops: the same variable read
+///    before and after one is still one node, which codegen re-emits (see
+///    ExprAST::codegen).
+///
+/// Nothing that could fail to compile is folded away, so errors are the
+/// same either way.
+class ExprBuilder {
+    /// NumberBitsInfo - Hashes the bits of a double. DenseMap's own hash for
+    /// integers multiplies and truncates to 32 bits, which maps every number
+    /// with a short mantissa (integers, halves) to the same bucket.
+    struct NumberBitsInfo : llvm::DenseMapInfo<uint64_t> {
+        static unsigned getHashValue(uint64_t Bits) { return llvm::hash_value(Bits); }
+    };
+
+    ASTArena &Arena;
+    bool Simplify;
+    llvm::DenseMap<uint64_t, ExprAST *, NumberBitsInfo> Numbers;
+    llvm::DenseMap<Symbol, ExprAST *> Variables;
+    llvm::DenseMap<std::tuple<char, const ExprAST *, const ExprAST *>, ExprAST *> Binaries;
+
+    static uint64_t bitsOf(double Val) {
+        uint64_t Bits;
+        memcpy(&Bits, &Val, sizeof(Bits));
+        return Bits;
+    }
 
-/// identifierexpr
-///   ::= identifier
-///   ::= identifier '(' expression* ')'
-static std::unique_ptr<ExprAST> ParseIdentifierOrCallExpr(){
-    std::string IdName = IdentifierStr;
+    /// isNumber - Whether E is the number Val; 0 and -0 are told apart.
+    static bool isNumber(const ExprAST *E, double Val) {
+        auto *N = llvm::dyn_cast<NumberExprAST>(E);
+        return N && bitsOf(N->getVal()) == bitsOf(Val);
+    }
 
-    getNextToken(); //eat identifier.
+    public:
+        ExprBuilder(ASTArena &Arena, bool Simplify) : Arena(Arena), Simplify(Simplify) {}
+
+        ExprAST *number(double Val) {
+            if (!Simplify)
+                return Arena.create<NumberExprAST>(Val);
+            ExprAST *&N = Numbers[bitsOf(Val)];
+            if (!N)
+                N = Arena.create<NumberExprAST>(Val);
+            return N;
+        }
 
-    if(CurTok != '(') //Simple variable ref.
-        return std::make_unique<VariableExprAST>(IdName);
+        ExprAST *variable(Symbol Name) {
+            if (!Simplify)
+                return Arena.create<VariableExprAST>(Name);
+            ExprAST *&V = Variables[Name];
+            if (!V)
+                V = Arena.create<VariableExprAST>(Name);
+            return V;
+        }
 
-    getNextToken();// eat '('.
-    std::vector<std::unique_ptr<ExprAST>> Args;
-    if(CurTok!=')') {
-        while(1){
-            if(auto Arg = ParseExpression())
-                Args.push_back(std::move(Arg));
-            else
-                return nullptr;
-            
-            if(CurTok == ')')   
-                break;
-            
-            if(CurTok != ',')
-                return LogError("Expected ')' or ',' in argument list");
-            getNextToken();
+        ExprAST *binary(char Op, ExprAST *LHS, ExprAST *RHS) {
+            if (!Simplify)
+                return Arena.create<BinaryExprAST>(Op, LHS, RHS);
+
+            auto *L = llvm::dyn_cast<NumberExprAST>(LHS);
+            auto *R = llvm::dyn_cast<NumberExprAST>(RHS);
+            if (L && R) {
+                double A = L->getVal(), B = R->getVal();
+                switch (Op) {
+                    case '+': return number(A + B);
+                    case '-': return number(A - B);
+                    case '*': return number(A * B);
+                    case '<': return number(!(A >= B)); // unordered or less than
+                }
+            }
+            switch (Op) {
+                case '*':
+                    if (isNumber(RHS, 1))
+                        return LHS;
+                    if (isNumber(LHS, 1))
+                        return RHS;
+                    break;
+                case '-':
+                    if (isNumber(RHS, 0))
+                        return LHS;
+                    break;
+                case '+':
+                    if (isNumber(RHS, -0.0))
+                        return LHS;
+                    if (isNumber(LHS, -0.0))
+                        return RHS;
+                    break;
+                case ':':
+                    if (llvm::isa<NumberExprAST>(LHS))
+                        return RHS;
+                    break;
+            }
+
+            ExprAST *&B = Binaries[std::make_tuple(Op, LHS, RHS)];
+            if (!B)
+                B = Arena.create<BinaryExprAST>(Op, LHS, RHS);
+            return B;
         }
-    }
 
-    getNextToken(); //eat the ')'.
-    return std::make_unique<CallExprAST> (IdName, std::move(Args));
-}
+        ExprAST *call(Symbol Callee, llvm::ArrayRef<ExprAST *> Args) {
+            return Arena.create<CallExprAST>(Callee, Arena.copyArray(Args));
+        }
 
-/// primary
-///   ::= identifierexpr
-///   ::= numberexpr
-///   ::= parenexpr
-static std::unique_ptr<ExprAST> ParsePrimary() {
-    switch (CurTok) {
-        default:
-            return LogError("unknown token when expecting an expression");
-        case tok_identifier:
-            return ParseIdentifierOrCallExpr();
-        case tok_number:
-            return ParseNumberExpr();
-        case '(':
-            return ParseParenExpr();
-    }
+        ExprAST *ifExpr(ExprAST *Cond, ExprAST *Then, ExprAST *Else) {
+            return Arena.create<IfExprAST>(Cond, Then, Else);
+        }
+
+        ExprAST *forExpr(Symbol Var, ExprAST *Start, ExprAST *End, ExprAST *Body, ExprAST *Step) {
+            return Arena.create<ForExprAST>(Var, Start, End, Body, Step);
+        }
+
+        ExprAST *whileExpr(ExprAST *Cond, ExprAST *Body) {
+            return Arena.create<WhileExprAST>(Cond, Body);
+        }
+
+        /// varExpr - Operands are the initializers of Names, then the body.
+        ExprAST *varExpr(llvm::ArrayRef<Symbol> Names, llvm::ArrayRef<ExprAST *> Operands) {
+            return Arena.create<VarExprAST>(Arena.copyArray(Names), Arena.copyArray(Operands));
+        }
+
+        ExprAST *assign(Symbol Name, ExprAST *Value) {
+            return Arena.create<AssignExprAST>(Name, Value);
+        }
+};
+
+/// PrototypeAST - This class represents the "prototype" for a function,
+/// which captures its name, and its argument names (thus implicitly the number
+/// of arguments the function takes). Prototypes outlive the item they were
+/// parsed from (see FunctionProtos), so they are not arena allocated.
+
+class PrototypeAST{
+    Symbol Name;
+    std::vector<Symbol> Args;
+
+    public:
+        PrototypeAST(Symbol Name, std::vector<Symbol> Args):
+        Name(Name), Args(std::move(Args)) {}
+
+        Symbol getSymbol() const {return Name;}
+        llvm::StringRef getName() const {return getSymbolName(Name);}
+        const std::vector<Symbol> &getArgs() const {return Args;}
+
+        llvm::Function *codegen();
+};
+
+/// FunctionAST - This class represents a function definition itself. It owns
+/// the arena holding its body.
+class FunctionAST {
+    std::unique_ptr<ASTArena> Arena;
+    std::unique_ptr<PrototypeAST> Proto;
+    ExprAST *Body;
+
+    public:
+        FunctionAST(std::unique_ptr<ASTArena> Arena, std::unique_ptr<PrototypeAST> Proto, ExprAST *Body):
+            Arena(std::move(Arena)), Proto(std::move(Proto)), Body(Body) {}
+        
+        const PrototypeAST &getProto() const { return *Proto; }
+        ExprAST *getBody() const { return Body; }
+        const ASTArena &getArena() const { return *Arena; }
+
+        llvm::Function *codegen();
+};
+
+
+/// ErrorLog - If set, LogError appends the errors of this thread here, one
+/// per line, instead of printing them (the server sends each session its
+/// own).
+static thread_local std::string *ErrorLog = nullptr;
+
+/// LogError* - These are little helper functions for error handling.
+ExprAST *LogError(const char *Str){
+    if (ErrorLog)
+        ErrorLog->append(Str).push_back('\n');
+    else
+        fprintf(stderr, "LogError: %s\n", Str);
+    return nullptr;
 }
 
-///Binary Expression Parsing
+std::unique_ptr<PrototypeAST> LogErrorP(const char *Str) {
+    LogError(Str);
+    return nullptr;
+}
 
 /// BinopPrecedence - This holds the precedence for each binary operator that is
 /// defined.
 
 static std::map<char,int> BinopPrecedence;
 
-//GetTokPrecedence - Get the precedence of the pending binary operator token
-static int GetTokPrecedence() {
-    if(!isascii(CurTok))
-        return -1;
-    
-    //Make sure it's declared binop.
-    // int tokPrec = BinopPrecedence[CurTok];
-    // if (TokPrec <= 0) return -1;
-    // return TokPrec;
-
-    switch(CurTok){
-        case '<':
-        case '>':
-            return 10;
-        case '+':
-        case '-':
-            return 20;
-        case '*':
-        case '/':
-            return 40;
-        default:
-            return -1;
-
-    }
-}
-
 // int main() {
 //   // Install standard binary operators.
 //   // 1 is lowest precedence.
@@ -243,106 +550,426 @@ static int GetTokPrecedence() {
 //   ...
 // }
 
+static const Symbol Sym_anon_expr = internSymbol("__anon_expr");
+
+
+/// Parser - Parses one input, read through its own Lexer, into top-level
+/// items. Parsers share nothing but the symbol table, so each thread can run
+/// its own.
+class Parser {
+    Lexer Lex;
+
+    /// CurTok - The current token the parser is looking at.
+    int CurTok = 0;
+
+    /// Simplify - Whether expressions are simplified as they are built (see
+    /// ExprBuilder).
+    bool Simplify = true;
+
+    /// LexSeconds - Time spent in gettok() so far, kept up to date when
+    /// statistics are on.
+    double LexSeconds = 0;
+
+    ///Expression Parsing
+    ///
+    /// expression ::= primary (binop primary)*
+    /// primary
+    ///   ::= number
+    ///   ::= identifier
+    ///   ::= identifier '(' (expression (',' expression)*)? ')'
+    ///   ::= identifier '=' expression
+    ///   ::= '(' expression ')'
+    ///   ::= 'if' expression 'then' expression 'else' expression
+    ///   ::= 'for' identifier '=' expression ',' expression (',' expression)?
+    ///       'in' expression
+    ///   ::= 'while' expression 'do' expression
+    ///   ::= 'var' identifier ('=' expression)?
+    ///       (',' identifier ('=' expression)?)* 'in' expression
+    ///
+    /// Parsed by operator precedence with explicit stacks rather than by
+    /// recursive descent, so that neither the length of an expression nor the
+    /// depth of its parentheses and calls costs native stack: each token is
+    /// shifted once and each node built once, in linear time. The constructs
+    /// that start with a keyword are opened like a '(' and closed by their
+    /// next keyword; the expression they end with extends as far as it can,
+    /// as do the values of assignments, which bind looser than every binary
+    /// operator but ':'.
+
+    /// PendingOp - Something opened but not yet closed: a binary operator
+    /// waiting for its right operand, a '(', a call whose arguments start at
+    /// Operands[Base], an assignment waiting for its value, or a keyword
+    /// construct, of which Stage operands have been parsed.
+    struct PendingOp {
+        enum OpKind : uint8_t { Binary, Paren, Call, Assign, If, For, While, Var } Kind;
+        int Op = 0, Prec = 0;   // Binary, Assign.
+        Symbol Callee = 0;      // Call.
+        unsigned Base = 0;      // Call, Var.
+        Symbol Name = 0;        // Assign, For: the variable.
+        unsigned Stage = 0;     // If, For, While, Var.
+        unsigned NameBase = 0;  // Var: its names start at VarNames[NameBase].
+    };
+
+    /// AssignPrec - The precedence of '='.
+    enum { AssignPrec = 2 };
+
+    ExprAST *ParseExpression(ExprBuilder &B) {
+        llvm::SmallVector<ExprAST *, 16> Operands;
+        llvm::SmallVector<PendingOp, 16> Ops;
+        llvm::SmallVector<Symbol, 8> VarNames;
+
+        // reduce - Merge the binary operators and assignments above the
+        // innermost '(', call or keyword construct that bind at least as
+        // tightly as MinPrec, leftmost last, so operators of equal precedence
+        // associate to the left.
+        auto reduce = [&](int MinPrec) {
+            while (!Ops.empty() && Ops.back().Prec >= MinPrec &&
+                   (Ops.back().Kind == PendingOp::Binary || Ops.back().Kind == PendingOp::Assign)) {
+                PendingOp Op = Ops.pop_back_val();
+                ExprAST *RHS = Operands.pop_back_val();
+                if (Op.Kind == PendingOp::Assign) {
+                    Operands.push_back(B.assign(Op.Name, RHS));
+                    continue;
+                }
+                ExprAST *&LHS = Operands.back();
+                LHS = B.binary(Op.Op, LHS, RHS);
+            }
+        };
+
+        // openVarName - Start the binding of a local named by the current
+        // token. False if it is missing; otherwise, unless an initializer
+        // follows, the binding is complete with the default one.
+        auto openVarName = [&](bool &HasInit) {
+            if (CurTok != tok_identifier)
+                return false;
+            VarNames.push_back(Lex.getIdentifierSym());
+            getNextToken(); // eat identifier.
+            HasInit = CurTok == '=';
+            if (HasInit)
+                getNextToken(); // eat '='.
+            else
+                Operands.push_back(B.number(0));
+            return true;
+        };
+
+        while (1) {
+            // Expecting an operand: open any '('s, calls and keyword
+            // constructs in front of it.
+            switch (CurTok) {
+                default:
+                    return LogError("unknown token when expecting an expression");
+                case '(':
+                    getNextToken(); //eat (.
+                    Ops.push_back({PendingOp::Paren});
+                    continue;
+                case tok_if:
+                    getNextToken(); // eat if.
+                    Ops.push_back({PendingOp::If});
+                    continue;
+                case tok_while:
+                    getNextToken(); // eat while.
+                    Ops.push_back({PendingOp::While});
+                    continue;
+                case tok_for: {
+                    getNextToken(); // eat for.
+                    if (CurTok != tok_identifier)
+                        return LogError("expected identifier after for");
+                    PendingOp For = {PendingOp::For};
+                    For.Name = Lex.getIdentifierSym();
+                    getNextToken(); // eat identifier.
+                    if (CurTok != '=')
+                        return LogError("expected '=' after for");
+                    getNextToken(); // eat '='.
+                    Ops.push_back(For);
+                    continue;
+                }
+                case tok_var: {
+                    getNextToken(); // eat var.
+                    PendingOp Var = {PendingOp::Var};
+                    Var.Base = Operands.size();
+                    Var.NameBase = VarNames.size();
+                    Ops.push_back(Var);
+                    bool HasInit;
+                    if (!openVarName(HasInit))
+                        return LogError("expected identifier after var");
+                    if (HasInit)
+                        continue;
+                    break;
+                }
+                case tok_number:
+                    Operands.push_back(B.number(Lex.getNumVal()));
+                    getNextToken(); //consume the number
+                    break;
+                case tok_identifier: {
+                    Symbol IdName = Lex.getIdentifierSym();
+                    getNextToken(); //eat identifier.
+                    if (CurTok == '=') {
+                        getNextToken(); // eat '='.
+                        PendingOp Assign = {PendingOp::Assign};
+                        Assign.Prec = AssignPrec;
+                        Assign.Name = IdName;
+                        Ops.push_back(Assign);
+                        continue;
+                    }
+                    if (CurTok != '(') { //Simple variable ref.
+                        Operands.push_back(B.variable(IdName));
+                        break;
+                    }
+                    getNextToken(); // eat '('.
+                    if (CurTok == ')') {
+                        getNextToken(); //eat the ')'.
+                        Operands.push_back(B.call(IdName, {}));
+                        break;
+                    }
+                    PendingOp Call = {PendingOp::Call};
+                    Call.Callee = IdName;
+                    Call.Base = Operands.size();
+                    Ops.push_back(Call);
+                    continue;
+                }
+            }
+
+            // Have an operand: close whatever the following tokens close,
+            // until a binary operator, ',' or keyword asks for another
+            // operand.
+            while (1) {
+                int TokPrec = GetTokPrecedence();
+                if (TokPrec >= 0) {
+                    reduce(TokPrec);
+                    Ops.push_back({PendingOp::Binary, CurTok, TokPrec});
+                    getNextToken(); // eat binop
+                    break;
+                }
+
+                reduce(0);
+                if (Ops.empty())
+                    return Operands.back();
+
+                PendingOp &Open = Ops.back();
+                // expect - If the current token is Tok, eat it and move Open
+                // on to its next operand.
+                auto expect = [&](int Tok) {
+                    if (CurTok != Tok)
+                        return false;
+                    getNextToken();
+                    Open.Stage++;
+                    return true;
+                };
+                // close - Replace Open's last N operands by Node.
+                auto close = [&](unsigned N, ExprAST *Node) {
+                    Operands.resize(Operands.size() - N);
+                    Operands.push_back(Node);
+                    Ops.pop_back();
+                };
+                auto last = [&](unsigned N) { return llvm::makeArrayRef(Operands).take_back(N); };
+
+                switch (Open.Kind) {
+                    case PendingOp::Paren:
+                        if (CurTok != ')')
+                            return LogError("expected ')'");
+                        getNextToken(); //eat ).
+                        Ops.pop_back();
+                        continue;
+
+                    case PendingOp::If:
+                        if (Open.Stage == 0) {
+                            if (!expect(tok_then))
+                                return LogError("expected then");
+                            break;
+                        }
+                        if (Open.Stage == 1) {
+                            if (!expect(tok_else))
+                                return LogError("expected else");
+                            break;
+                        }
+                        close(3, B.ifExpr(last(3)[0], last(3)[1], last(3)[2]));
+                        continue;
+
+                    case PendingOp::While:
+                        if (Open.Stage == 0) {
+                            if (!expect(tok_do))
+                                return LogError("expected do after while condition");
+                            break;
+                        }
+                        close(2, B.whileExpr(last(2)[0], last(2)[1]));
+                        continue;
+
+                    case PendingOp::For:
+                        if (Open.Stage == 0) {
+                            if (!expect(','))
+                                return LogError("expected ',' after for start value");
+                            break;
+                        }
+                        if (Open.Stage == 1) {
+                            if (expect(','))
+                                break;
+                            // No step: count by 1.
+                            Operands.push_back(B.number(1));
+                            Open.Stage++;
+                        }
+                        if (Open.Stage == 2) {
+                            if (!expect(tok_in))
+                                return LogError("expected 'in' after for");
+                            break;
+                        }
+                        // Start, End, Step, Body.
+                        close(4, B.forExpr(Open.Name, last(4)[0], last(4)[1], last(4)[3],
+                                           last(4)[2]));
+                        continue;
+
+                    case PendingOp::Var:
+                        if (Open.Stage == 0) {
+                            if (CurTok == ',') {
+                                getNextToken(); // eat ','.
+                                bool HasInit;
+                                if (!openVarName(HasInit))
+                                    return LogError("expected identifier list after var");
+                                if (HasInit)
+                                    break;
+                                continue;
+                            }
+                            if (!expect(tok_in))
+                                return LogError("expected 'in' keyword after 'var'");
+                            break;
+                        }
+                        {
+                            llvm::ArrayRef<Symbol> Names =
+                                llvm::makeArrayRef(VarNames).drop_front(Open.NameBase);
+                            unsigned N = Operands.size() - Open.Base;
+                            ExprAST *Node = B.varExpr(Names, last(N));
+                            VarNames.resize(Open.NameBase);
+                            close(N, Node);
+                        }
+                        continue;
+
+                    default: // a call
+                        if (CurTok == ',') {
+                            getNextToken();
+                            break;
+                        }
+                        if (CurTok != ')')
+                            return LogError("Expected ')' or ',' in argument list");
+                        getNextToken(); //eat the ')'.
+                        llvm::ArrayRef<ExprAST *> Args = llvm::makeArrayRef(Operands).drop_front(Open.Base);
+                        close(Args.size(), B.call(Open.Callee, Args));
+                        continue;
+                }
+                break;
+            }
+        }
+    }
 
-/// expression
-///   ::= primary binoprhs
-///
-static std::unique_ptr<ExprAST> ParseExpression(){
-    auto LHS = ParsePrimary();
-    if (!LHS)
-        return nullptr;
-    
-    return ParseBinOpRHS(0,std::move(LHS));
-}
+    public:
+        Lexer &getLexer() { return Lex; }
+
+        int getCurTok() const { return CurTok; }
+
+        /// getLexSeconds - Time this parser has spent lexing, when --stats is on.
+        const double &getLexSeconds() const { return LexSeconds; }
+
+        /// getNextToken - Provide a simple token buffer: read another token
+        /// from the lexer and update CurTok with its result, timing the lexer
+        /// for --stats.
+        int getNextToken(){
+            if (!TheStats)
+                return CurTok = Lex.gettok();
+            auto Start = StatsClock::now();
+            CurTok = Lex.gettok();
+            LexSeconds += secondsSince(Start);
+            return CurTok;
+        }
 
+        //GetTokPrecedence - Get the precedence of the pending binary operator token
+        int GetTokPrecedence() const {
+            if(!isascii(CurTok))
+                return -1;
+
+            //Make sure it's declared binop.
+            // int tokPrec = BinopPrecedence[CurTok];
+            // if (TokPrec <= 0) return -1;
+            // return TokPrec;
+
+            switch(CurTok){
+                case ':':
+                    return 1;
+                case '<':
+                case '>':
+                    return 10;
+                case '+':
+                case '-':
+                    return 20;
+                case '*':
+                case '/':
+                    return 40;
+                default:
+                    return -1;
+
+            }
+        }
 
-/// binoprhs
-///   ::= ('+' primary)*
-static std::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec,std::unique_ptr<ExprAST> LHS){
-    // If this is a binop, find its precedence.
-    while(1){
-        int TokPrec = GetTokPrecedence();
+        /// setSimplify - Whether to simplify expressions as they are parsed,
+        /// on by default.
+        void setSimplify(bool S) { Simplify = S; }
 
-        // If this is a binop that binds at least as tightly as the current binop,
-        // consume it, otherwise we are done.
-        if(TokPrec<ExprPrec)
-            return LHS;
-        
-        // Okay, we know this is a binop.
-        int BinOp = CurTok;
-        getNextToken();  // eat binop
+        /// ParseExpression - Parse an expression, allocating its nodes in Arena.
+        ExprAST *ParseExpression(ASTArena &Arena) {
+            ExprBuilder B(Arena, Simplify);
+            return ParseExpression(B);
+        }
 
-        // Parse the primary expression after the binary operator.
-        auto RHS = ParsePrimary();
-        if(!RHS)
-            return nullptr;
+        ///Parsing the Rest
+        std::unique_ptr<PrototypeAST> ParsePrototype() {
+            if( CurTok != tok_identifier)
+                return LogErrorP("Expected function name in prototype");
 
-        // If BinOp binds less tightly with RHS than the operator after RHS, let
-        // the pending operator take RHS as its LHS.
-        int NextPrec = GetTokPrecedence();
-        if (TokPrec < NextPrec) {
-            RHS = ParseBinOpRHS(TokPrec+1,std::move(RHS));
-            if(!RHS)
-                return nullptr;
-        }
+            Symbol FnName = Lex.getIdentifierSym();
+            getNextToken();
 
-        // Merge LHS/RHS.
-        LHS = std::make_unique<BinaryExprAST>(BinOp, std::move(LHS),std::move(RHS));
+            if(CurTok != '(')
+                return LogErrorP("Expected '(' in prototype");
 
-    }
-}
+            //Read the list of argument names.
+            std::vector<Symbol> ArgNames;
+            while(getNextToken() == tok_identifier)
+                ArgNames.push_back(Lex.getIdentifierSym());
 
-///Parsing the Rest
-static std::unique_ptr<PrototypeAST> ParsePrototype() {
-    if( CurTok != tok_identifier)
-        return LogErrorP("Expected function name in prototype");
-    
-    std::string FnName = IdentifierStr;
-    getNextToken();
-    
-    if(CurTok != '(')
-        return LogErrorP("Expected '(' in prototype");
-
-    //Read the list of argument names.
-    std::vector<std::string> ArgNames;
-    while(getNextToken() == tok_identifier)
-        ArgNames.push_back(IdentifierStr);
-    
-    if(CurTok != ')')
-        return LogErrorP("Expected ')' in prototype");
-
-    //Success.
-    getNextToken(); //eat ')'.
-
-    return std::make_unique<PrototypeAST> (FnName, std::move(ArgNames));
-}
+            if(CurTok != ')')
+                return LogErrorP("Expected ')' in prototype");
 
-/// definition ::= 'def' prototype expression
-static std::unique_ptr<FunctionAST> ParseDefinition() {
-    getNextToken(); //eat def.
-    auto Proto = ParsePrototype();
-    if(!Proto) return nullptr;
+            //Success.
+            getNextToken(); //eat ')'.
 
-    if (auto E = ParseExpression())
-        return std::make_unique<FunctionAST>(std::move(Proto),std::move(E));
-    return nullptr; 
-}
+            return std::make_unique<PrototypeAST> (FnName, std::move(ArgNames));
+        }
 
-/// external ::= 'extern' prototype
-static std::unique_ptr<PrototypeAST> ParseExtern() {
-  getNextToken();  // eat extern.
-  return ParsePrototype();
-}
+        /// definition ::= 'def' prototype expression
+        std::unique_ptr<FunctionAST> ParseDefinition() {
+            getNextToken(); //eat def.
+            auto Proto = ParsePrototype();
+            if(!Proto) return nullptr;
 
-/// toplevelexpr ::= expression
-static std::unique_ptr<FunctionAST> ParseTopLevelExpr() {
-  if (auto E = ParseExpression()) {
-    // Make an anonymous proto.
-    auto Proto = std::make_unique<PrototypeAST>("", std::vector<std::string>());
-    return std::make_unique<FunctionAST>(std::move(Proto), std::move(E));
-  }
-  return nullptr;
-}
+            auto Arena = std::make_unique<ASTArena>();
+            if (auto *E = ParseExpression(*Arena))
+                return std::make_unique<FunctionAST>(std::move(Arena),std::move(Proto),E);
+            return nullptr;
+        }
+
+        /// external ::= 'extern' prototype
+        std::unique_ptr<PrototypeAST> ParseExtern() {
+            getNextToken();  // eat extern.
+            return ParsePrototype();
+        }
+
+        /// toplevelexpr ::= expression
+        std::unique_ptr<FunctionAST> ParseTopLevelExpr() {
+            auto Arena = std::make_unique<ASTArena>();
+            if (auto *E = ParseExpression(*Arena)) {
+                // Make an anonymous proto.
+                auto Proto = std::make_unique<PrototypeAST>(Sym_anon_expr, std::vector<Symbol>());
+                return std::make_unique<FunctionAST>(std::move(Arena), std::move(Proto), E);
+            }
+            return nullptr;
+        }
+};
 
 //===----------------------------------------------------------------------===//
 // Top-Level parsing
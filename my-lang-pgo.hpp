@@ -0,0 +1,282 @@
+#include<bits/stdc++.h>
+#include "my-lang-interp.hpp"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/ProfileData/InstrProf.h"
+#include "llvm/ProfileData/InstrProfWriter.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Transforms/Instrumentation/PGOInstrumentation.h"
+
+
+//===----------------------------------------------------------------------===//
+// Profile-guided optimization
+//===----------------------------------------------------------------------===//
+
+/// ReoptThreshold - --pgo=N: calls after which an instrumented definition is
+/// re-optimized with the profile collected so far.
+static uint64_t ReoptThreshold = 10000;
+
+/// ProfiledFunction - A definition the JIT runs with instrumentation (--pgo).
+/// Counters is written by the JIT'd code: [0] counts calls, the rest are the
+/// counters LLVM's IR instrumentation placed on the function's edges.
+struct ProfiledFunction {
+    std::string Name;
+    /// The function's module as generated, before instrumentation: the IR
+    /// its profile describes.
+    llvm::SmallVector<char, 0> Bitcode;
+    uint64_t Hash = 0;
+    unsigned NumCounters = 0;
+    std::unique_ptr<std::atomic<uint64_t>[]> Counters;
+    /// Only touched by the re-optimization thread.
+    bool Reoptimized = false;
+
+    uint64_t getCalls() const { return Counters[0].load(std::memory_order_relaxed); }
+};
+
+/// ProfiledFunctions - Every instrumented definition, by name. Entries are
+/// added by the driver and never removed; ProfileLock guards the map.
+static llvm::StringMap<std::unique_ptr<ProfiledFunction>> ProfiledFunctions;
+static std::mutex ProfileLock;
+
+static ProfiledFunction *findProfiledFunction(llvm::StringRef Name) {
+    std::lock_guard<std::mutex> Lock(ProfileLock);
+    auto It = ProfiledFunctions.find(Name);
+    return It == ProfiledFunctions.end() ? nullptr : It->getValue().get();
+}
+
+/// runProfilePass - Run the module pass P over M on its own, outside the
+/// optimization pipeline.
+template <typename PassT>
+static void runProfilePass(llvm::Module &M, PassT P) {
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+    llvm::PassBuilder PB;
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+    llvm::ModulePassManager MPM;
+    MPM.addPass(std::move(P));
+    MPM.run(M, MAM);
+}
+
+/// instrumentDefinition - Instrument the definition Name in M, which must be
+/// the module FunctionAST::codegen() generated for it, and rename it
+/// "Name.instr" (see KaleidoscopeJIT::addRedirectableModule).
+///
+/// The counters are placed by LLVM's IR-level PGO instrumentation, so the
+/// profile is one that PGOInstrumentationUse, and hence an ahead-of-time
+/// build, can read back. They are lowered here to plain increments of an
+/// array in this process rather than through compiler-rt's profile runtime:
+/// the profile is read straight from memory while the program runs.
+static void instrumentDefinition(llvm::Module &M, llvm::StringRef Name) {
+    auto PF = std::make_unique<ProfiledFunction>();
+    PF->Name = Name.str();
+    llvm::raw_svector_ostream OS(PF->Bitcode);
+    llvm::WriteBitcodeToFile(M, OS);
+
+    runProfilePass(M, llvm::PGOInstrumentationGen());
+
+    llvm::Function *F = M.getFunction(Name);
+    llvm::SmallVector<llvm::InstrProfIncrementInst *, 8> Increments;
+    for (llvm::Instruction &I : llvm::instructions(*F))
+        if (auto *Inc = llvm::dyn_cast<llvm::InstrProfIncrementInst>(&I))
+            Increments.push_back(Inc);
+    if (!Increments.empty()) {
+        PF->Hash = Increments[0]->getHash()->getZExtValue();
+        PF->NumCounters = Increments[0]->getNumCounters()->getZExtValue();
+    }
+    PF->Counters.reset(new std::atomic<uint64_t>[PF->NumCounters + 1]());
+
+    llvm::Type *Int64Ty = llvm::Type::getInt64Ty(M.getContext());
+    llvm::Constant *Counters = llvm::ConstantExpr::getIntToPtr(
+        llvm::ConstantInt::get(Int64Ty, reinterpret_cast<uintptr_t>(PF->Counters.get())),
+        Int64Ty->getPointerTo());
+    auto Increment = [&](llvm::Instruction *Before, uint64_t Index, llvm::Value *Step) {
+        llvm::IRBuilder<> B(Before);
+        llvm::Value *Addr = B.CreateConstInBoundsGEP1_64(Int64Ty, Counters, Index);
+        // Counters are std::atomic on the C++ side, read by the reoptimizer
+        // thread while this code runs: access them as monotonic atomics. Only
+        // the JIT'd code writes them, so a load and store (no locked RMW) is
+        // enough.
+        llvm::LoadInst *Count = B.CreateAlignedLoad(Int64Ty, Addr, llvm::Align(8), "pgocount");
+        Count->setAtomic(llvm::AtomicOrdering::Monotonic);
+        llvm::StoreInst *Store = B.CreateAlignedStore(B.CreateAdd(Count, Step), Addr, llvm::Align(8));
+        Store->setAtomic(llvm::AtomicOrdering::Monotonic);
+    };
+    Increment(&*F->getEntryBlock().getFirstInsertionPt(), 0, llvm::ConstantInt::get(Int64Ty, 1));
+
+    llvm::SmallPtrSet<llvm::GlobalVariable *, 2> NameVars;
+    for (auto *Inc : Increments) {
+        Increment(Inc, 1 + Inc->getIndex()->getZExtValue(), Inc->getStep());
+        NameVars.insert(Inc->getName());
+        Inc->eraseFromParent();
+    }
+    // Only the profile runtime reads these.
+    for (auto *GV : NameVars)
+        if (GV->use_empty())
+            GV->eraseFromParent();
+    if (auto *GV = M.getGlobalVariable(INSTR_PROF_QUOTE(INSTR_PROF_RAW_VERSION_VAR)))
+        GV->eraseFromParent();
+
+    F->setName(Name + ".instr");
+
+    std::lock_guard<std::mutex> Lock(ProfileLock);
+    ProfiledFunctions[Name] = std::move(PF);
+}
+
+/// writeProfile - Write the counts collected so far, of every instrumented
+/// definition, to Path as an indexed profile (llvm-profdata's format).
+static llvm::Error writeProfile(llvm::StringRef Path) {
+    llvm::InstrProfWriter Writer;
+    if (auto Err = Writer.mergeProfileKind(llvm::InstrProfKind::IR))
+        return Err;
+    llvm::Error Err = llvm::Error::success();
+    auto Warn = [&](llvm::Error E) { Err = llvm::joinErrors(std::move(Err), std::move(E)); };
+    {
+        std::lock_guard<std::mutex> Lock(ProfileLock);
+        for (auto &Entry : ProfiledFunctions) {
+            ProfiledFunction &F = *Entry.getValue();
+            if (!F.NumCounters)
+                continue;
+            std::vector<uint64_t> Counts;
+            for (unsigned I = 1; I <= F.NumCounters; ++I)
+                Counts.push_back(F.Counters[I].load(std::memory_order_relaxed));
+            Writer.addRecord(llvm::NamedInstrProfRecord(F.Name, F.Hash, std::move(Counts)), Warn);
+        }
+    }
+    if (Err)
+        return Err;
+
+    std::error_code EC;
+    llvm::raw_fd_ostream OS(Path, EC);
+    if (EC)
+        return llvm::createFileError(Path, EC);
+    return Writer.write(OS);
+}
+
+/// applyProfile - Annotate M with the counts Path holds for its functions
+/// (branch weights, entry counts, the profile summary), for the optimizer's
+/// inlining, layout and hot/cold decisions.
+static void applyProfile(llvm::Module &M, llvm::StringRef Path) {
+    runProfilePass(M, llvm::PGOInstrumentationUse(Path.str()));
+}
+
+/// reoptimize - Compile F again from its uninstrumented IR, optimized with
+/// the profile, as "Name.pgo", and point the stub everyone calls it through
+/// at that. The definitions F can reach are linked in as internal copies,
+/// as batch entry points do, so that the optimizer can inline the hot calls.
+static llvm::Error reoptimize(ProfiledFunction &F) {
+    auto Context = std::make_unique<llvm::LLVMContext>();
+    auto Parse = [&](ProfiledFunction &P) {
+        return llvm::parseBitcodeFile(
+            llvm::MemoryBufferRef(llvm::StringRef(P.Bitcode.data(), P.Bitcode.size()), P.Name),
+            *Context);
+    };
+    auto M = Parse(F);
+    if (!M)
+        return M.takeError();
+
+    // Link until every callee with a definition has one in M.
+    for (bool Linked = true; Linked;) {
+        Linked = false;
+        for (llvm::Function &G : **M) {
+            ProfiledFunction *Callee;
+            if (!G.isDeclaration() || !(Callee = findProfiledFunction(G.getName())))
+                continue;
+            auto CalleeM = Parse(*Callee);
+            if (!CalleeM)
+                return CalleeM.takeError();
+            if (llvm::Linker::linkModules(**M, std::move(*CalleeM)))
+                return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                               "cannot link '%s' into '%s'",
+                                               Callee->Name.c_str(), F.Name.c_str());
+            Linked = true;
+            break;
+        }
+    }
+
+    // PGOInstrumentationUse reads its profile from a file.
+    llvm::SmallString<128> Path;
+    int FD;
+    if (auto EC = llvm::sys::fs::createTemporaryFile("kaleidoscope", "profdata", FD, Path))
+        return llvm::errorCodeToError(EC);
+    llvm::sys::Process::SafelyCloseFileDescriptor(FD);
+    llvm::Error Err = writeProfile(Path);
+    if (!Err)
+        applyProfile(**M, Path);
+    llvm::sys::fs::remove(Path);
+    if (Err)
+        return Err;
+
+    std::string Impl = F.Name + ".pgo";
+    for (llvm::Function &G : **M) {
+        if (G.isDeclaration())
+            continue;
+        if (G.getName() == F.Name)
+            G.setName(Impl);
+        else
+            G.setLinkage(llvm::Function::InternalLinkage);
+    }
+    (*M)->setModuleIdentifier(Impl);
+    if (auto Err = TheJIT->addModule(
+            llvm::orc::ThreadSafeModule(std::move(*M), std::move(Context))))
+        return Err;
+    return TheJIT->redirect(F.Name, Impl);
+}
+
+/// Reoptimizer - The thread that re-optimizes definitions once they have
+/// been called ReoptThreshold times, while the program keeps running.
+static std::unique_ptr<std::thread> Reoptimizer;
+static std::condition_variable ReoptimizerWake;
+static bool ReoptimizerStop = false;
+
+static void runReoptimizer() {
+    std::unique_lock<std::mutex> Lock(ProfileLock);
+    while (!ReoptimizerStop) {
+        ReoptimizerWake.wait_for(Lock, std::chrono::milliseconds(10));
+        std::vector<ProfiledFunction *> Hot;
+        for (auto &Entry : ProfiledFunctions) {
+            ProfiledFunction &F = *Entry.getValue();
+            if (!F.Reoptimized && F.getCalls() >= ReoptThreshold) {
+                F.Reoptimized = true;
+                Hot.push_back(&F);
+            }
+        }
+        Lock.unlock();
+        for (ProfiledFunction *F : Hot)
+            if (auto Err = reoptimize(*F))
+                llvm::logAllUnhandledErrors(std::move(Err), llvm::errs(), "Error: ");
+        Lock.lock();
+    }
+}
+
+/// stopReoptimizer - Let the re-optimization in progress, if any, finish and
+/// stop the thread.
+static void stopReoptimizer() {
+    if (!Reoptimizer)
+        return;
+    {
+        std::lock_guard<std::mutex> Lock(ProfileLock);
+        ReoptimizerStop = true;
+    }
+    ReoptimizerWake.notify_all();
+    Reoptimizer->join();
+    Reoptimizer.reset();
+}
+
+static void startReoptimizer() {
+    Reoptimizer = std::make_unique<std::thread>(runReoptimizer);
+    // Before the JIT goes away, however the program exits.
+    std::atexit(stopReoptimizer);
+}
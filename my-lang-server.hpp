@@ -0,0 +1,254 @@
+#include<bits/stdc++.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "my-lang-pgo.hpp"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+
+
+//===----------------------------------------------------------------------===//
+// Evaluation server (--serve)
+//
+// The driver loads a library of definitions, compiles all of it, and then
+// serves sessions on a Unix domain socket, each connection one session.
+// A request is one line of source holding any number of complete top-level
+// items. The response is one line: the values of the request's top-level
+// expressions, separated by spaces (empty if it had none), or "error: "
+// and what went wrong, in which case the rest of the request was skipped.
+//
+// Each session has its own JITDylib, which links against the main one
+// holding the library, and its own copy of the front end's tables. Its
+// definitions and externs are invisible to other sessions, and it may
+// define a name the library already uses. Sessions run on threads of their
+// own. They take turns generating IR, but compile and run code
+// concurrently.
+//===----------------------------------------------------------------------===//
+
+/// FrontEndLock - Held while generating IR: the code generator's state is
+/// global. Whenever it is free, FunctionProtos, FunctionDefs and Externs
+/// describe the library.
+static std::mutex FrontEndLock;
+
+/// Session - The top-level state of one client.
+struct Session {
+    unsigned ID = 0;
+    llvm::orc::JITDylib *JD = nullptr;
+    /// Top-level expressions run so far, to name each uniquely.
+    unsigned NumExprs = 0;
+    llvm::DenseMap<Symbol, std::unique_ptr<PrototypeAST>> Protos;
+    llvm::DenseMap<Symbol, std::unique_ptr<FunctionAST>> Defs;
+    llvm::DenseSet<Symbol> Externs;
+};
+
+/// SessionScope - For as long as it lives, the front end works on S's
+/// tables and generates code into a module of its own.
+class SessionScope {
+    std::lock_guard<std::mutex> Lock;
+    Session &S;
+    ModuleScope Scope;
+
+    void swapTables() {
+        std::swap(S.Protos, FunctionProtos);
+        std::swap(S.Defs, FunctionDefs);
+        std::swap(S.Externs, Externs);
+    }
+
+public:
+    explicit SessionScope(Session &S) : Lock(FrontEndLock), S(S) { swapTables(); }
+    ~SessionScope() { swapTables(); }
+
+    llvm::orc::ThreadSafeModule take(llvm::StringRef Name) { return Scope.take(Name); }
+};
+
+/// serveRequest - Run the items in Source in session S and return the
+/// response line.
+static std::string serveRequest(Session &S, llvm::StringRef Source) {
+    std::string Errors;
+    ErrorLog = &Errors;
+    auto Fail = [&](std::string Message) {
+        ErrorLog = nullptr;
+        if (Message.empty())
+            Message = Errors.empty() ? "invalid input" : Errors;
+        std::replace(Message.begin(), Message.end(), '\n', ' ');
+        while (!Message.empty() && Message.back() == ' ')
+            Message.pop_back();
+        return "error: " + Message;
+    };
+
+    Parser P;
+    P.setSimplify(OptLevel > 0);
+    P.getLexer().setBuffer(Source);
+    P.getNextToken();
+    std::string Response;
+    while (P.getCurTok() != tok_eof) {
+        if (P.getCurTok() == ';') {
+            P.getNextToken();
+            continue;
+        }
+
+        if (P.getCurTok() == tok_extern) {
+            auto ProtoAST = P.ParseExtern();
+            if (!ProtoAST)
+                return Fail("");
+            SessionScope Scope(S);
+            ProtoAST->codegen();
+            Externs.insert(ProtoAST->getSymbol());
+            FunctionProtos[ProtoAST->getSymbol()] = std::move(ProtoAST);
+            continue;
+        }
+
+        bool IsDefinition = P.getCurTok() == tok_def;
+        auto FnAST = IsDefinition ? P.ParseDefinition() : P.ParseTopLevelExpr();
+        if (!FnAST)
+            return Fail("");
+        std::string Name = IsDefinition ? FnAST->getProto().getName().str() : "";
+        llvm::orc::ThreadSafeModule TSM;
+        {
+            SessionScope Scope(S);
+            // The session's own definitions; it may shadow the library's.
+            if (IsDefinition && FunctionDefs.count(FnAST->getProto().getSymbol())) {
+                LogError("Function cannot be redefined.");
+                return Fail("");
+            }
+            auto *FnIR = FnAST->codegen();
+            if (!FnIR)
+                return Fail("");
+            if (!IsDefinition) {
+                Name = ("__anon_expr." + llvm::Twine(S.ID) + "." + llvm::Twine(S.NumExprs++)).str();
+                FnIR->setName(Name);
+            }
+            TSM = Scope.take(IsDefinition ? Name : FnAST->getProto().getName());
+        }
+
+        if (IsDefinition) {
+            if (auto Err = TheJIT->addModule(std::move(TSM), S.JD->getDefaultResourceTracker()))
+                return Fail(llvm::toString(std::move(Err)));
+            S.Defs[FnAST->getProto().getSymbol()] = std::move(FnAST);
+            continue;
+        }
+
+        // As in the driver: run the expression from a tracker of its own and
+        // free its code right after.
+        auto RT = S.JD->createResourceTracker();
+        if (auto Err = TheJIT->addModule(std::move(TSM), RT))
+            return Fail(llvm::toString(std::move(Err)));
+        auto Sym = TheJIT->lookup(*S.JD, Name);
+        if (!Sym) {
+            llvm::consumeError(TheJIT->removeModule(RT));
+            return Fail(llvm::toString(Sym.takeError()));
+        }
+        double (*FP)() = (double (*)())(intptr_t)Sym->getAddress();
+        char Value[32];
+        snprintf(Value, sizeof(Value), "%.17g", FP());
+        if (auto Err = TheJIT->removeModule(RT))
+            return Fail(llvm::toString(std::move(Err)));
+        if (!Response.empty())
+            Response += ' ';
+        Response += Value;
+    }
+    ErrorLog = nullptr;
+    return Response;
+}
+
+/// writeAll - Send all of Data on FD, false if the client went away.
+static bool writeAll(int FD, llvm::StringRef Data) {
+    while (!Data.empty()) {
+        ssize_t N = write(FD, Data.data(), Data.size());
+        if (N < 0 && errno == EINTR)
+            continue;
+        if (N <= 0)
+            return false;
+        Data = Data.drop_front(N);
+    }
+    return true;
+}
+
+/// NumSessions - Sessions started so far, to name their JITDylibs and code.
+static std::atomic<unsigned> NumSessions{0};
+
+/// serveSession - Answer the requests on the connection FD until the client
+/// closes it, then free everything the session defined.
+static void serveSession(int FD) {
+    Session S;
+    S.ID = NumSessions++;
+    auto JD = TheJIT->createJITDylib("session." + std::to_string(S.ID));
+    if (!JD) {
+        writeAll(FD, "error: " + llvm::toString(JD.takeError()) + "\n");
+        close(FD);
+        return;
+    }
+    S.JD = &*JD;
+    {
+        // Start from the library's prototypes and externs.
+        std::lock_guard<std::mutex> Lock(FrontEndLock);
+        for (auto &P : FunctionProtos)
+            S.Protos[P.first] = std::make_unique<PrototypeAST>(*P.second);
+        S.Externs = Externs;
+    }
+
+    std::string Buffer;
+    char Chunk[4096];
+    bool Open = true;
+    while (Open) {
+        ssize_t N = read(FD, Chunk, sizeof(Chunk));
+        if (N < 0 && errno == EINTR)
+            continue;
+        if (N <= 0)
+            break;
+        Buffer.append(Chunk, N);
+        size_t Start = 0, End;
+        while (Open && (End = Buffer.find('\n', Start)) != std::string::npos) {
+            std::string Response =
+                serveRequest(S, llvm::StringRef(Buffer).slice(Start, End));
+            Open = writeAll(FD, Response + "\n");
+            Start = End + 1;
+        }
+        Buffer.erase(0, Start);
+    }
+    close(FD);
+
+    if (auto Err = TheJIT->removeJITDylib(*S.JD))
+        llvm::logAllUnhandledErrors(std::move(Err), llvm::errs(), "Error: ");
+    // The session's ASTs go with it, outside the lock.
+}
+
+/// runServer - Serve sessions on the Unix domain socket Path until killed.
+/// A stale socket file at Path is replaced.
+static int runServer(llvm::StringRef Path) {
+    sockaddr_un Addr = {};
+    Addr.sun_family = AF_UNIX;
+    if (Path.size() >= sizeof(Addr.sun_path)) {
+        fprintf(stderr, "Error: socket path '%s' is too long\n", Path.str().c_str());
+        return 1;
+    }
+    memcpy(Addr.sun_path, Path.data(), Path.size());
+
+    int Listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (Listener < 0) {
+        perror("Error: socket");
+        return 1;
+    }
+    unlink(Addr.sun_path);
+    if (bind(Listener, (sockaddr *)&Addr, sizeof(Addr)) < 0 || listen(Listener, SOMAXCONN) < 0) {
+        fprintf(stderr, "Error: cannot listen on '%s': %s\n", Addr.sun_path, strerror(errno));
+        close(Listener);
+        return 1;
+    }
+    // A client that hangs up mid-response must not kill the server.
+    signal(SIGPIPE, SIG_IGN);
+    fprintf(stderr, "Serving on %s\n", Addr.sun_path);
+
+    while (true) {
+        int FD = accept(Listener, nullptr, nullptr);
+        if (FD < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("Error: accept");
+            close(Listener);
+            return 1;
+        }
+        std::thread(serveSession, FD).detach();
+    }
+}
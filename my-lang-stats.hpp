@@ -0,0 +1,209 @@
+#include<bits/stdc++.h>
+#include <sys/resource.h>
+#include "llvm/ADT/Any.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/PassInstrumentation.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+
+//===----------------------------------------------------------------------===//
+// Compile statistics (--stats)
+//===----------------------------------------------------------------------===//
+
+typedef std::chrono::steady_clock StatsClock;
+
+static double secondsSince(StatsClock::time_point Start) {
+    return std::chrono::duration<double>(StatsClock::now() - Start).count();
+}
+
+/// ItemStats - What compiling the items that define one function cost. Every
+/// phase is wall time in seconds; Passes breaks Optimize down by pass.
+/// Anonymous expressions all share the "__anon_expr" entry, so Count says how
+/// many items went into it, and CacheHits how many of those were loaded from
+/// the --cache-dir cache instead of compiled. MemoHits and MemoMisses count
+/// the calls to a memoized function (--memoize) answered from its cache and
+/// computed, up to the end of the run. Specializations counts the clones
+/// made of a function for constant arguments (--specialize).
+struct ItemStats {
+    uint64_t Count = 0, CacheHits = 0;
+    uint64_t MemoHits = 0, MemoMisses = 0;
+    uint64_t Specializations = 0;
+    double Lex = 0, Parse = 0, IRGen = 0, Optimize = 0, CodeGen = 0;
+    uint64_t ASTNodes = 0;
+    uint64_t InstsBefore = 0, InstsAfter = 0;
+    uint64_t ObjectBytes = 0;
+    llvm::StringMap<double> Passes;
+
+    void add(const ItemStats &S) {
+        Count += S.Count;
+        CacheHits += S.CacheHits;
+        MemoHits += S.MemoHits;
+        MemoMisses += S.MemoMisses;
+        Specializations += S.Specializations;
+        Lex += S.Lex;
+        Parse += S.Parse;
+        IRGen += S.IRGen;
+        Optimize += S.Optimize;
+        CodeGen += S.CodeGen;
+        ASTNodes += S.ASTNodes;
+        InstsBefore += S.InstsBefore;
+        InstsAfter += S.InstsAfter;
+        ObjectBytes += S.ObjectBytes;
+        for (auto &P : S.Passes)
+            Passes[P.getKey()] += P.getValue();
+    }
+
+    llvm::json::Object toJSON() const {
+        llvm::json::Object PassTimes;
+        for (auto &P : Passes)
+            PassTimes[P.getKey()] = P.getValue();
+        return llvm::json::Object{
+            {"count", Count},
+            {"cache_hits", CacheHits},
+            {"seconds", llvm::json::Object{{"lex", Lex},
+                                           {"parse", Parse},
+                                           {"irgen", IRGen},
+                                           {"optimize", Optimize},
+                                           {"codegen", CodeGen}}},
+            {"passes", std::move(PassTimes)},
+            {"ast_nodes", ASTNodes},
+            {"ir_instructions", llvm::json::Object{{"before_opt", InstsBefore},
+                                                   {"after_opt", InstsAfter}}},
+            {"object_bytes", ObjectBytes},
+            {"memo", llvm::json::Object{{"hits", MemoHits}, {"misses", MemoMisses}}},
+            {"specializations", Specializations},
+        };
+    }
+};
+
+/// CompileStats - ItemStats by function name. The front end records from the
+/// main thread, but modules are optimized and compiled on whichever thread
+/// the JIT or the AOT driver picks, so every update goes through the lock.
+/// Items are matched up across phases by module identifier, which the driver
+/// sets to the name of the function the module defines.
+class CompileStats {
+    std::mutex Lock;
+    llvm::StringMap<ItemStats> Items;
+
+    public:
+        template <typename Fn>
+        void update(llvm::StringRef Name, Fn Update) {
+            std::lock_guard<std::mutex> Guard(Lock);
+            Update(Items[Name]);
+        }
+
+        /// toJSON - Per-function and total figures, plus the process's peak
+        /// resident set size.
+        llvm::json::Value toJSON() {
+            std::lock_guard<std::mutex> Guard(Lock);
+            llvm::json::Object Functions;
+            ItemStats Total;
+            for (auto &I : Items) {
+                Functions[I.getKey()] = I.getValue().toJSON();
+                Total.add(I.getValue());
+            }
+
+            struct rusage RU;
+            getrusage(RUSAGE_SELF, &RU);
+#ifdef __APPLE__
+            uint64_t PeakRSS = RU.ru_maxrss;
+#else
+            uint64_t PeakRSS = (uint64_t)RU.ru_maxrss * 1024;
+#endif
+            return llvm::json::Object{{"functions", std::move(Functions)},
+                                      {"total", Total.toJSON()},
+                                      {"peak_rss_bytes", PeakRSS}};
+        }
+
+        void print(llvm::raw_ostream &OS) { OS << llvm::formatv("{0:2}\n", toJSON()); }
+};
+
+/// TheStats - Where statistics go; null unless --stats was given, in which
+/// case every hook below is skipped.
+static std::unique_ptr<CompileStats> TheStats;
+
+/// FrontEndTimer - Times one top-level item through the front end. The time
+/// from construction to parsed() is split into lexing and parsing, the
+/// former read off LexSeconds, the parser's running total of time spent in
+/// its lexer; from there to generated() is IR generation (including
+/// verification), or the cache lookup that made it unnecessary.
+class FrontEndTimer {
+    const double &LexSeconds;
+    StatsClock::time_point Start;
+    double LexStart = 0, Lex = 0, Parse = 0;
+
+    public:
+        explicit FrontEndTimer(const double &LexSeconds) : LexSeconds(LexSeconds) {
+            if (TheStats) {
+                Start = StatsClock::now();
+                LexStart = LexSeconds;
+            }
+        }
+
+        void parsed() {
+            if (!TheStats)
+                return;
+            double Elapsed = secondsSince(Start);
+            Lex = LexSeconds - LexStart;
+            Parse = Elapsed - Lex;
+            Start = StatsClock::now();
+        }
+
+        void generated(llvm::StringRef Name, uint64_t ASTNodes, bool CacheHit = false) {
+            if (!TheStats)
+                return;
+            double IRGen = secondsSince(Start);
+            TheStats->update(Name, [&](ItemStats &S) {
+                S.Count++;
+                S.CacheHits += CacheHit;
+                S.Lex += Lex;
+                S.Parse += Parse;
+                S.IRGen += IRGen;
+                S.ASTNodes += ASTNodes;
+            });
+        }
+};
+
+/// isPassWrapper - Pass managers, adaptors and the like only run other
+/// passes; timing them as well would count that time twice.
+static bool isPassWrapper(llvm::StringRef PassID) {
+    for (const char *W : {"PassManager", "PassAdaptor", "AnalysisManagerProxy",
+                          "ModuleInlinerWrapperPass", "DevirtSCCRepeatedPass"})
+        if (PassID.contains(W))
+            return true;
+    return false;
+}
+
+/// PassTimers - Accumulates the time of every pass run under PIC into
+/// Passes. Must outlive the pipeline run.
+class PassTimers {
+    std::vector<StatsClock::time_point> Starts;
+
+    void stop(llvm::StringRef PassID) {
+        if (isPassWrapper(PassID))
+            return;
+        Passes[PassID] += secondsSince(Starts.back());
+        Starts.pop_back();
+    }
+
+    public:
+        llvm::StringMap<double> Passes;
+
+        void registerCallbacks(llvm::PassInstrumentationCallbacks &PIC) {
+            PIC.registerBeforeNonSkippedPassCallback([this](llvm::StringRef PassID, llvm::Any) {
+                if (!isPassWrapper(PassID))
+                    Starts.push_back(StatsClock::now());
+            });
+            PIC.registerAfterPassCallback(
+                [this](llvm::StringRef PassID, llvm::Any, const llvm::PreservedAnalyses &) {
+                    stop(PassID);
+                });
+            PIC.registerAfterPassInvalidatedCallback(
+                [this](llvm::StringRef PassID, const llvm::PreservedAnalyses &) {
+                    stop(PassID);
+                });
+        }
+};